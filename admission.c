@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "admission.h"
+#include "shared.h"
+
+#define NUM_SHARDS 16
+#define SHARD_SLOTS 1024
+#define MAX_PROBE 8
+#define MILLI 1000
+
+/* A bucket's state is packed into one word so it can be updated with a
+   single compare-and-swap: the upper 40 bits hold the time of the last
+   refill in ms, the lower 24 bits the tokens left in thousandths. */
+#define TOKEN_BITS 24
+#define TOKEN_MASK ((1UL << TOKEN_BITS) - 1)
+#define MAX_BURST (TOKEN_MASK / MILLI)
+
+typedef struct bucket_struct
+{
+    uint32_t addr;      // 0 when the slot is free
+    uint64_t state;
+} bucket_t;
+
+typedef struct admission_counts_struct
+{
+    unsigned long checked;
+    unsigned long limited;
+    unsigned long shed;
+} admission_counts_t;
+
+// shared memory with several workers, so a client's rate is counted once
+static bucket_t (*buckets)[SHARD_SLOTS];
+
+static int tokens_per_sec = 0;
+static uint64_t bucket_size;    // in thousandths of a token
+static uint64_t idle_ms;        // time after which a bucket is full again
+static int shed_threshold = 0;
+
+// rejections are counted where they are sent, whoever decided on them;
+// shared like the buckets, so /stats adds up every worker
+static admission_counts_t local_counts;
+static admission_counts_t* counts = &local_counts;
+
+static char* too_many_requests = "HTTP/1.0 429 TOO MANY REQUESTS\r\n"\
+                                 "Retry-After: 1\r\n"\
+                                 "Content-type: text/html\r\n\r\n"\
+                                 "<html><body><h2>TOO MANY REQUESTS</h2>"\
+                                 "</body></html>\n";
+
+static char* unavailable = "HTTP/1.0 503 SERVICE UNAVAILABLE\r\n"\
+                           "Retry-After: 1\r\n"\
+                           "Content-type: text/html\r\n\r\n"\
+                           "<html><body><h2>SERVICE UNAVAILABLE</h2>"\
+                           "</body></html>\n";
+
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void admission_init(int rate, int burst, int shed_depth)
+{
+    if (burst < 1)
+        burst = 1;
+    if (burst > MAX_BURST)
+        burst = MAX_BURST;
+    tokens_per_sec = rate > 0 ? rate : 0;
+    bucket_size = (uint64_t) burst * MILLI;
+    idle_ms = tokens_per_sec > 0 ? (uint64_t) burst * 1000 / tokens_per_sec + 1 : 0;
+    shed_threshold = shed_depth > 0 ? shed_depth : 0;
+    if ((counts = (admission_counts_t*) shared_calloc(1, sizeof(admission_counts_t))) == NULL)
+        counts = &local_counts;
+    if (tokens_per_sec > 0)
+    {
+        buckets = (bucket_t (*)[SHARD_SLOTS]) shared_calloc(NUM_SHARDS, sizeof(*buckets));
+        if (buckets == NULL)
+            tokens_per_sec = 0;
+    }
+}
+
+/*
+ * Find or claim the bucket for addr. A slot whose owner has been idle
+ * long enough to be back at a full bucket carries no information and
+ * is reused, which is how old clients age out of the table.
+ * Returns NULL when the probe window is full of active clients.
+ */
+static bucket_t* find_bucket(uint32_t addr, uint64_t now)
+{
+    uint32_t hash = addr * 2654435761U;
+    bucket_t* shard = buckets[hash % NUM_SHARDS];
+    int start = (hash / NUM_SHARDS) % SHARD_SLOTS;
+    int i;
+
+    for (i = 0; i < MAX_PROBE; i++)
+    {
+        bucket_t* b = &shard[(start + i) % SHARD_SLOTS];
+        uint32_t owner = __atomic_load_n(&b->addr, __ATOMIC_ACQUIRE);
+        uint64_t last;
+
+        if (owner == addr)
+            return b;
+
+        last = __atomic_load_n(&b->state, __ATOMIC_RELAXED) >> TOKEN_BITS;
+        if (owner == 0 || (now > last && now - last > idle_ms))
+        {
+            if (__atomic_compare_exchange_n(&b->addr, &owner, addr, false,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                __atomic_store_n(&b->state, (now << TOKEN_BITS) | bucket_size, __ATOMIC_RELEASE);
+                return b;
+            }
+            // someone else claimed it first; it may even be our address
+            if (owner == addr)
+                return b;
+        }
+    }
+    return NULL;
+}
+
+static int take_token(bucket_t* b, uint64_t now)
+{
+    uint64_t old_state = __atomic_load_n(&b->state, __ATOMIC_ACQUIRE);
+    uint64_t new_state, last, tokens;
+
+    do
+    {
+        last = old_state >> TOKEN_BITS;
+        tokens = old_state & TOKEN_MASK;
+        if (now > last)
+        {
+            tokens += (now - last) * tokens_per_sec;
+            last = now;
+        }
+        if (tokens > bucket_size)
+            tokens = bucket_size;
+        if (tokens < MILLI)
+            return 0;
+        new_state = (last << TOKEN_BITS) | (tokens - MILLI);
+    } while (!__atomic_compare_exchange_n(&b->state, &old_state, new_state, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return 1;
+}
+
+admission_t admission_check(uint32_t addr, int queue_depth)
+{
+    __atomic_add_fetch(&counts->checked, 1, __ATOMIC_RELAXED);
+    if (shed_threshold > 0 && queue_depth >= shed_threshold)
+        return SHED;
+
+    if (tokens_per_sec > 0)
+    {
+        uint64_t now = now_ms();
+        bucket_t* b = find_bucket(addr, now);
+        // with no slot to track the client we let it through
+        if (b != NULL && !take_token(b, now))
+            return RATE_LIMITED;
+    }
+    return ADMIT;
+}
+
+void admission_reject(int connfd, admission_t reason)
+{
+    char discard[1024];
+    char* response = (reason == SHED) ? unavailable : too_many_requests;
+
+    __atomic_add_fetch(reason == SHED ? &counts->shed : &counts->limited, 1, __ATOMIC_RELAXED);
+
+    // a single non-blocking send; a client that cannot take it loses it
+    send(connfd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(connfd, SHUT_WR);
+    // drain what already arrived so close does not turn into a reset
+    while (recv(connfd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+        ;
+    close(connfd);
+}
+
+void admission_stats(char* buf, int bufsize)
+{
+    // a connection shed after admission_check let it through (full
+    // thread pool queue, no io_uring slot) is not accepted after all
+    unsigned long limited = __atomic_load_n(&counts->limited, __ATOMIC_RELAXED);
+    unsigned long shed = __atomic_load_n(&counts->shed, __ATOMIC_RELAXED);
+    unsigned long checked = __atomic_load_n(&counts->checked, __ATOMIC_RELAXED);
+
+    snprintf(buf, bufsize, "accepted %lu\nrate_limited %lu\nshed %lu\n",
+            checked > limited + shed ? checked - limited - shed : 0, limited, shed);
+}
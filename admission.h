@@ -0,0 +1,50 @@
+#ifndef _ADMISSION_H_
+#define _ADMISSION_H_
+
+#include <stdint.h>
+
+typedef enum
+{
+    ADMIT,
+    RATE_LIMITED,
+    SHED
+} admission_t;
+
+/**
+ * @function admission_init
+ * @brief Configures per-client rate limiting and load shedding. Called
+ *        before the workers are forked, they share one set of buckets
+ *        and of counters.
+ * @param rate       Requests per second each source address may make,
+ *                   0 disables rate limiting.
+ * @param burst      Bucket size, i.e. requests allowed back to back.
+ * @param shed_depth Queue depth at which new connections are shed,
+ *                   0 disables shedding.
+ */
+void admission_init(int rate, int burst, int shed_depth);
+
+/**
+ * @function admission_check
+ * @brief Decides whether a freshly accepted connection gets a worker.
+ *        Lock-free, called right after accept.
+ * @param addr        Client IPv4 address in network byte order.
+ * @param queue_depth Tasks currently waiting in the thread pool.
+ * @return ADMIT, RATE_LIMITED or SHED
+ */
+admission_t admission_check(uint32_t addr, int queue_depth);
+
+/**
+ * @function admission_reject
+ * @brief Sends the 429/503 response for a rejected connection without
+ *        blocking and closes it. Counts the rejection for admission_stats,
+ *        including connections shed after admission_check admitted them.
+ */
+void admission_reject(int connfd, admission_t reason);
+
+/**
+ * @function admission_stats
+ * @brief Formats the accepted/rejected counters as "name value" lines.
+ */
+void admission_stats(char* buf, int bufsize);
+
+#endif
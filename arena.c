@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define THREAD_ARENA_SIZE (64*1024)
+#define SPARE_LIMIT (4*1024*1024)   // bytes of trimmed chunks kept for reuse
+
+typedef struct arena_chunk_struct
+{
+    struct arena_chunk_struct* next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_chunk_t;
+
+/**
+ *  @struct arena_t
+ *  @brief chain of chunks; everything after current is unused
+ */
+struct arena_t
+{
+    arena_chunk_t* head;
+    arena_chunk_t* current;
+    size_t chunk_size;
+};
+
+static __thread arena_t* local_arena = NULL;
+
+/* Chunks given up by arena_trim, handed to the next arena that grows */
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+static arena_chunk_t* spare_chunks = NULL;
+static size_t spare_bytes = 0;
+
+
+/* First spare chunk with room for size bytes, or NULL */
+static arena_chunk_t* take_spare(size_t size)
+{
+    arena_chunk_t** link;
+    arena_chunk_t* chunk = NULL;
+
+    pthread_mutex_lock(&spare_lock);
+    for (link = &spare_chunks; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->size >= size)
+        {
+            chunk = *link;
+            *link = chunk->next;
+            spare_bytes -= chunk->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&spare_lock);
+    return chunk;
+}
+
+static void give_spare(arena_chunk_t* chunk)
+{
+    pthread_mutex_lock(&spare_lock);
+    if (spare_bytes + chunk->size <= SPARE_LIMIT)
+    {
+        chunk->next = spare_chunks;
+        spare_chunks = chunk;
+        spare_bytes += chunk->size;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&spare_lock);
+    free(chunk);
+}
+
+int arena_reserve(size_t size, int count)
+{
+    int i;
+
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+    pthread_mutex_lock(&spare_lock);
+    for (i = 0; i < count && spare_bytes + size <= SPARE_LIMIT; i++)
+    {
+        arena_chunk_t* chunk = (arena_chunk_t*) malloc(sizeof(arena_chunk_t) + size);
+        if (chunk == NULL)
+            break;
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = spare_chunks;
+        spare_chunks = chunk;
+        spare_bytes += size;
+    }
+    pthread_mutex_unlock(&spare_lock);
+    return i;
+}
+
+static arena_chunk_t* chunk_create(size_t size)
+{
+    arena_chunk_t* chunk = take_spare(size);
+    if (chunk != NULL)
+    {
+        chunk->next = NULL;
+        chunk->used = 0;
+        return chunk;
+    }
+    chunk = (arena_chunk_t*) malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+arena_t* arena_create(size_t chunk_size)
+{
+    arena_t* arena = (arena_t*) malloc(sizeof(arena_t));
+    if (arena == NULL)
+        return NULL;
+    arena->chunk_size = chunk_size;
+    arena->head = chunk_create(chunk_size);
+    if (arena->head == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->head;
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    arena_chunk_t* chunk = arena->current;
+
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+    while (chunk->used + size > chunk->size)
+    {
+        if (chunk->next == NULL)
+        {
+            arena_chunk_t* fresh = chunk_create(size > arena->chunk_size ? size : arena->chunk_size);
+            if (fresh == NULL)
+                return NULL;
+            chunk->next = fresh;
+        }
+        // chunks past current hold nothing from this round
+        chunk = chunk->next;
+        chunk->used = 0;
+    }
+    arena->current = chunk;
+
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char* arena_strndup(arena_t* arena, const char* str, size_t n)
+{
+    size_t len = strnlen(str, n);
+    char* copy = (char*) arena_alloc(arena, len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t* arena)
+{
+    arena->head->used = 0;
+    arena->current = arena->head;
+}
+
+void arena_trim(arena_t* arena)
+{
+    arena_chunk_t* curr = arena->head->next;
+    while (curr != NULL)
+    {
+        arena_chunk_t* temp = curr;
+        curr = curr->next;
+        give_spare(temp);
+    }
+    arena->head->next = NULL;
+    arena_reset(arena);
+}
+
+void arena_destroy(arena_t* arena)
+{
+    arena_chunk_t* curr = arena->head;
+    while (curr != NULL)
+    {
+        arena_chunk_t* temp = curr;
+        curr = curr->next;
+        free(temp);
+    }
+    free(arena);
+}
+
+arena_t* thread_arena()
+{
+    if (local_arena == NULL)
+        local_arena = arena_create(THREAD_ARENA_SIZE);
+    return local_arena;
+}
@@ -0,0 +1,64 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+typedef struct arena_t arena_t;
+
+/**
+ * @function arena_create
+ * @brief Creates a bump allocator that hands out memory from chunks of
+ *        chunk_size bytes (larger requests get a chunk of their own).
+ * @return a new arena or NULL
+ */
+arena_t* arena_create(size_t chunk_size);
+
+/**
+ * @function arena_alloc
+ * @brief Allocates size bytes, aligned for any type. Never freed
+ *        individually; everything goes away with arena_reset.
+ * @return the memory, or NULL if a new chunk could not be allocated
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * @function arena_strndup
+ * @brief Copies at most n bytes of str into the arena, NUL terminated.
+ */
+char* arena_strndup(arena_t* arena, const char* str, size_t n);
+
+/**
+ * @function arena_reset
+ * @brief Releases every allocation at once. Chunks are kept, so an
+ *        arena that has seen its largest request stops calling malloc.
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * @function arena_trim
+ * @brief arena_reset that also gives up every chunk but the first, for
+ *        arenas that are many and mostly idle (one per connection slot)
+ *        where keeping a rare large request's chunks would add up. Up to
+ *        SPARE_LIMIT bytes of those chunks are kept for whichever arena
+ *        grows next, so repeating large requests still do not malloc.
+ */
+void arena_trim(arena_t* arena);
+
+/**
+ * @function arena_reserve
+ * @brief Puts up to count chunks of size bytes among those spares ahead
+ *        of time (never past SPARE_LIMIT), so the first large requests
+ *        do not malloc either.
+ * @return how many chunks were reserved
+ */
+int arena_reserve(size_t size, int count);
+
+void arena_destroy(arena_t* arena);
+
+/**
+ * @function thread_arena
+ * @brief The calling thread's arena, created on first use.
+ */
+arena_t* thread_arena();
+
+#endif
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "assets.h"
+
+#define ASSET_MAX_SIZE (16*1024*1024)   // larger files are streamed from disk as before
+
+/**
+ *  @struct asset_variant_t
+ *  @brief one encoding of a file with its ready-made response header;
+ *         data is NULL if the variant was not worth keeping
+ */
+typedef struct asset_variant_struct
+{
+    char* header;
+    char* data;
+    int len;
+} asset_variant_t;
+
+typedef struct asset_struct
+{
+    char* name;
+    asset_variant_t plain;
+    asset_variant_t gzip;
+    asset_variant_t br;
+    struct asset_struct* next;
+} asset_t;
+
+static asset_t* assets = NULL;
+
+static const struct
+{
+    const char* extension;
+    const char* content_type;
+    int text;                   // worth compressing
+} content_types[] = {
+    { ".html", "text/html", 1 },
+    { ".css",  "text/css", 1 },
+    { ".js",   "application/javascript", 1 },
+    { ".json", "application/json", 1 },
+    { ".txt",  "text/plain", 1 },
+    { ".svg",  "image/svg+xml", 1 },
+    { ".png",  "image/png", 0 },
+    { ".jpg",  "image/jpeg", 0 },
+    { ".gif",  "image/gif", 0 },
+    { ".ico",  "image/x-icon", 0 },
+};
+
+
+static int content_type_of(const char* name)
+{
+    const char* dot = strrchr(name, '.');
+    int i;
+
+    if (dot == NULL)
+        return -1;
+    for (i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i++)
+    {
+        if (strcasecmp(dot, content_types[i].extension) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static char* read_file(const char* name, int* len)
+{
+    struct stat st;
+    char* data;
+    int fd, total = 0, n;
+
+    if ((fd = open(name, O_RDONLY)) == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > ASSET_MAX_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    data = (char*) malloc(st.st_size > 0 ? st.st_size : 1);
+    while (data != NULL && total < st.st_size && (n = read(fd, data + total, st.st_size - total)) > 0)
+        total += n;
+    close(fd);
+    if (data != NULL && total != st.st_size)
+    {
+        free(data);
+        return NULL;
+    }
+    *len = total;
+    return data;
+}
+
+static char* gzip_compress(const char* data, int len, int* out_len)
+{
+    z_stream zs;
+    uLong bound;
+    char* out;
+
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15 + 16 asks for a gzip wrapper instead of zlib's
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    bound = deflateBound(&zs, len);
+    if ((out = (char*) malloc(bound)) == NULL)
+    {
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef*) data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef*) out;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+    {
+        deflateEnd(&zs);
+        free(out);
+        return NULL;
+    }
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+static char* brotli_compress(const char* data, int len, int text, int* out_len)
+{
+#ifdef HAVE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(len);
+    char* out;
+
+    if (size == 0 || (out = (char*) malloc(size)) == NULL)
+        return NULL;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                text ? BROTLI_MODE_TEXT : BROTLI_MODE_GENERIC,
+                len, (const uint8_t*) data, &size, (uint8_t*) out))
+    {
+        free(out);
+        return NULL;
+    }
+    *out_len = (int) size;
+    return out;
+#else
+    return NULL;
+#endif
+}
+
+/* Keep a compressed variant only if it actually saves bytes */
+static void add_variant(asset_variant_t* variant, const char* content_type,
+        const char* encoding, char* data, int len, int plain_len)
+{
+    char header[256];
+
+    if (data == NULL)
+        return;
+    if (encoding != NULL && len >= plain_len)
+    {
+        free(data);
+        return;
+    }
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+            "Content-type: %s\r\n"
+            "%s%s%s"
+            "Content-Length: %d\r\n"
+            "Vary: Accept-Encoding\r\n\r\n",
+            content_type,
+            encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "",
+            len);
+    variant->header = strdup(header);
+    variant->data = data;
+    variant->len = len;
+}
+
+static asset_t* load_asset(const char* name)
+{
+    int type = content_type_of(name);
+    asset_t* asset;
+    char* data;
+    int len, packed_len = 0;
+
+    if (type < 0 || (data = read_file(name, &len)) == NULL)
+        return NULL;
+    if ((asset = (asset_t*) calloc(1, sizeof(asset_t))) == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+    asset->name = strdup(name);
+    add_variant(&asset->plain, content_types[type].content_type, NULL, data, len, len);
+
+    // images are compressed already, deflating them again never pays off
+    if (content_types[type].text)
+    {
+        char* packed = gzip_compress(data, len, &packed_len);
+        add_variant(&asset->gzip, content_types[type].content_type, "gzip", packed, packed_len, len);
+        packed = brotli_compress(data, len, 1, &packed_len);
+        add_variant(&asset->br, content_types[type].content_type, "br", packed, packed_len, len);
+    }
+
+    printf("Asset %s: %d bytes, gzip %d, br %d\n", name, len,
+            asset->gzip.data ? asset->gzip.len : 0, asset->br.data ? asset->br.len : 0);
+    return asset;
+}
+
+int assets_init()
+{
+    DIR* dir = opendir(".");
+    struct dirent* entry;
+    int count = 0;
+
+    if (dir == NULL)
+    {
+        perror("opendir");
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        asset_t* asset = load_asset(entry->d_name);
+        if (asset == NULL)
+            continue;
+        asset->next = assets;
+        assets = asset;
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+int assets_find(const char* name, int encodings, char** header, char** body, int* body_len)
+{
+    asset_t* curr = assets;
+    asset_variant_t* best;
+
+    while (curr != NULL && strcmp(curr->name, name) != 0)
+        curr = curr->next;
+    if (curr == NULL)
+        return -1;
+
+    best = &curr->plain;
+    if ((encodings & ENCODING_GZIP) && curr->gzip.data != NULL && curr->gzip.len < best->len)
+        best = &curr->gzip;
+    if ((encodings & ENCODING_BR) && curr->br.data != NULL && curr->br.len < best->len)
+        best = &curr->br;
+
+    *header = best->header;
+    *body = best->data;
+    *body_len = best->len;
+    return 0;
+}
+
+/*
+ * "gzip, deflate, br;q=0.5" -> GZIP|BR. A coding listed with q=0 is
+ * refused, "*" stands for every coding not listed.
+ */
+int assets_accepted(const char* value)
+{
+    int accepted = 0, refused = 0;
+
+    while (value != NULL && *value != '\0')
+    {
+        const char* end = value + strcspn(value, ",");
+        const char* param;
+        int len, bit = 0;
+        double q = 1.0;
+
+        while (value < end && isspace(*value))
+            value++;
+        len = strcspn(value, " \t;,");
+        if (len == 4 && strncasecmp(value, "gzip", 4) == 0)
+            bit = ENCODING_GZIP;
+        else if (len == 2 && strncasecmp(value, "br", 2) == 0)
+            bit = ENCODING_BR;
+        else if (len == 1 && *value == '*')
+            bit = ENCODING_GZIP | ENCODING_BR;
+
+        param = strchr(value, ';');
+        if (param != NULL && param < end && (param = strstr(param, "q=")) != NULL && param < end)
+            q = atof(param + 2);
+
+        if (q > 0)
+            accepted |= bit;
+        else if (len != 1)
+            refused |= bit;
+        value = *end ? end + 1 : end;
+    }
+    return accepted & ~refused;
+}
+
+void assets_destroy()
+{
+    while (assets != NULL)
+    {
+        asset_t* temp = assets;
+        assets = assets->next;
+        free(temp->plain.header);
+        free(temp->plain.data);
+        free(temp->gzip.header);
+        free(temp->gzip.data);
+        free(temp->br.header);
+        free(temp->br.data);
+        free(temp->name);
+        free(temp);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _ASSETS_H_
+#define _ASSETS_H_
+
+/* Content codings a client accepts, as a bit mask */
+#define ENCODING_GZIP 1
+#define ENCODING_BR   2
+
+/**
+ * @function assets_init
+ * @brief Loads the static files of the current directory (.html, .css,
+ *        .js, .png, ...) into memory together with gzip and, when built
+ *        with HAVE_BROTLI, brotli variants of each. A variant is only
+ *        kept if it is smaller than the file itself.
+ * @return number of files loaded, -1 on error
+ */
+int assets_init();
+
+/**
+ * @function assets_find
+ * @brief Looks up a static file loaded by assets_init and picks the
+ *        smallest variant the client accepts. Everything returned stays
+ *        valid until assets_destroy.
+ * @param name      File name as requested (without the leading '/').
+ * @param encodings ENCODING_* bits from the client's Accept-Encoding.
+ * @param header    Set to the complete response header for the variant.
+ * @param body      Set to the variant's bytes.
+ * @param body_len  Set to the variant's length.
+ * @return 0 if found, -1 if name was not loaded
+ */
+int assets_find(const char* name, int encodings, char** header, char** body, int* body_len);
+
+/**
+ * @function assets_accepted
+ * @brief Parses an Accept-Encoding value into ENCODING_* bits, honouring
+ *        "q=0" exclusions.
+ */
+int assets_accepted(const char* accept_encoding);
+
+void assets_destroy();
+
+#endif
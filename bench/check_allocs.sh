@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# Checks that the steady-state request path does no heap allocation, in
+# both the thread pool and the io_uring (-u) backend. The server runs
+# under bench/malloc_count.so; after a warm-up the allocation count is
+# sampled around a batch of requests and has to stay where it was.
+#
+#   bench/check_allocs.sh [seconds] [port]
+#
+# Run from the top of the tree; the server serves files from there.
+
+SECONDS_PER_RUN=${1:-3}
+PORT=${2:-8091}
+SEATS=1000
+CONNECTIONS=16
+PATHS="/list_seats /view_seat?seat=7&user=1 /selectSeats.html /stats"
+COUNTS=$(mktemp)
+status=0
+
+make -s http_server bench/loadgen bench/malloc_count.so || exit 1
+
+sample()
+{
+    : > $COUNTS
+    kill -USR1 $1 || return 1
+    while [ ! -s $COUNTS ] && kill -0 $1 2> /dev/null
+    do
+        sleep 0.1
+    done
+    cat $COUNTS
+}
+
+check()
+{
+    label=$1
+    shift
+    # a ring from the previous run can hold the port for a moment
+    for attempt in 1 2 3 4 5
+    do
+        MALLOC_COUNT_FILE=$COUNTS LD_PRELOAD=bench/malloc_count.so \
+            ./http_server -p $PORT "$@" $SEATS > /dev/null 2>&1 &
+        server=$!
+        sleep 1
+        kill -0 $server 2> /dev/null && break
+    done
+    if ! kill -0 $server 2> /dev/null
+    then
+        echo "$label: server did not start"
+        status=1
+        return
+    fi
+
+    # First requests size the thread arenas, stdio buffers and so on.
+    # The largest body at four times the measured concurrency grows
+    # every arena the measured run can reach, then the mix warms the rest.
+    bench/loadgen -p $PORT -c $((CONNECTIONS * 4)) -d 1 /list_seats > /dev/null
+    bench/loadgen -p $PORT -c $CONNECTIONS -d 1 $PATHS > /dev/null
+    before=$(sample $server)
+    result=$(bench/loadgen -p $PORT -c $CONNECTIONS -d $SECONDS_PER_RUN $PATHS)
+    after=$(sample $server)
+    kill -INT $server
+    wait $server 2> /dev/null
+
+    requests=$(echo "$result" | awk '{ print $2 }')
+    allocations=$((${after:-0} - ${before:-0}))
+    echo "$label: $requests requests, $allocations allocations"
+    if [ -z "$before" ] || [ -z "$after" ] || [ "$allocations" -ne 0 ] || [ "${requests:-0}" -eq 0 ]
+    then
+        status=1
+    fi
+}
+
+check "threadpool"
+check "io_uring" -u
+rm -f $COUNTS
+
+if [ $status -eq 0 ]
+then
+    echo "OK: no allocations on the request path"
+else
+    echo "FAILED: the request path allocates"
+fi
+exit $status
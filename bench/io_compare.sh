@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Requests per second of the default thread pool against the io_uring
+# backend (-u), on the seat map and on a static file.
+#
+#   bench/io_compare.sh [seconds] [connections]
+#
+# Run from the top of the tree; the server serves files from there.
+
+SECONDS_PER_RUN=${1:-10}
+CONNECTIONS=${2:-32}
+PORT=8080
+
+make -s http_server bench/loadgen || exit 1
+
+run()
+{
+    label=$1
+    shift
+    ./http_server "$@" > /dev/null 2>&1 &
+    server=$!
+    sleep 1
+    if ! kill -0 $server 2> /dev/null
+    then
+        echo "$label: server did not start"
+        return
+    fi
+    for path in /list_seats /selectSeats.html
+    do
+        printf "%-12s %-18s " "$label" "$path"
+        bench/loadgen -p $PORT -c $CONNECTIONS -d $SECONDS_PER_RUN $path
+    done
+    kill -INT $server
+    wait $server 2> /dev/null
+}
+
+echo "$(nproc) cores, $CONNECTIONS connections, ${SECONDS_PER_RUN}s per run"
+run "threadpool"
+run "io_uring" -u
@@ -0,0 +1,186 @@
+/*
+ * Closed-loop load generator for http_server. Each thread opens a
+ * connection, sends one request, reads the response until the server
+ * closes it (the server speaks HTTP/1.0) and starts over, for a fixed
+ * time. Prints the totals and requests per second.
+ *
+ *   loadgen [-h host] [-p port] [-c connections] [-d seconds] path...
+ *
+ * With several paths, each thread cycles through them.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define RESPONSE_BUF 65536
+
+typedef struct loader_struct
+{
+    pthread_t thread;
+    int first_path;
+    unsigned long ok;
+    unsigned long failed;
+    unsigned long bytes;
+} loader_t;
+
+static struct sockaddr_in server_addr;
+static char** paths;
+static int path_count;
+static volatile int running = 1;
+
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One request on a fresh connection; returns the bytes read, -1 on failure */
+static long fetch(const char* path, char* buf)
+{
+    char request[1024];
+    int fd, length, one = 1;
+    long total = 0;
+    ssize_t n;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    length = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", path);
+    if (write(fd, request, length) != length)
+    {
+        close(fd);
+        return -1;
+    }
+    while ((n = read(fd, buf, RESPONSE_BUF)) > 0)
+    {
+        // only a status line that says 200 counts
+        if (total == 0 && (n < 12 || strncmp(buf + 9, "200", 3) != 0))
+        {
+            close(fd);
+            return -1;
+        }
+        total += n;
+    }
+    close(fd);
+    return n < 0 || total == 0 ? -1 : total;
+}
+
+static void* load(void* arg)
+{
+    loader_t* loader = (loader_t*) arg;
+    char* buf = (char*) malloc(RESPONSE_BUF);
+    int next = loader->first_path;
+
+    while (running)
+    {
+        long n = fetch(paths[next], buf);
+        if (n < 0)
+        {
+            loader->failed++;
+        }
+        else
+        {
+            loader->ok++;
+            loader->bytes += n;
+        }
+        next = (next + 1) % path_count;
+    }
+    free(buf);
+    return NULL;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-c connections] [-d seconds] path...\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    const char* host = "127.0.0.1";
+    int port = 8080, connections = 16, seconds = 10;
+    unsigned long ok = 0, failed = 0, bytes = 0;
+    struct addrinfo hints, *found;
+    loader_t* loaders;
+    double start, elapsed;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "h:p:c:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind >= argc || connections < 1 || seconds < 1)
+        usage(argv[0]);
+    paths = argv + optind;
+    path_count = argc - optind;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &found) != 0)
+    {
+        fprintf(stderr, "Unknown host %s\n", host);
+        return 1;
+    }
+    memcpy(&server_addr, found->ai_addr, sizeof(server_addr));
+    server_addr.sin_port = htons(port);
+    freeaddrinfo(found);
+
+    loaders = (loader_t*) calloc(connections, sizeof(loader_t));
+    start = now_s();
+    for (i = 0; i < connections; i++)
+    {
+        loaders[i].first_path = i % path_count;
+        if (pthread_create(&loaders[i].thread, NULL, load, &loaders[i]) != 0)
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    sleep(seconds);
+    running = 0;
+    for (i = 0; i < connections; i++)
+    {
+        pthread_join(loaders[i].thread, NULL);
+        ok += loaders[i].ok;
+        failed += loaders[i].failed;
+        bytes += loaders[i].bytes;
+    }
+    elapsed = now_s() - start;
+    free(loaders);
+
+    printf("requests %lu failed %lu bytes %lu seconds %.2f req/s %.0f\n",
+            ok, failed, bytes, elapsed, ok / elapsed);
+    return failed > 0 && ok == 0;
+}
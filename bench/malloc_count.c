@@ -0,0 +1,101 @@
+/*
+ * LD_PRELOAD shim that counts heap allocations. On SIGUSR1 it appends
+ * the number of malloc/calloc/realloc/memalign calls made so far to
+ * $MALLOC_COUNT_FILE, so a driver can sample the count around a batch
+ * of requests. Built and used by bench/check_allocs.sh.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void* __libc_memalign(size_t, size_t);
+
+static unsigned long allocations = 0;
+static int report_fd = -1;
+
+
+static void count()
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count_, size_t size)
+{
+    count();
+    return __libc_calloc(count_, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    void* mem;
+
+    count();
+    if ((mem = __libc_memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *ptr = mem;
+    return 0;
+}
+
+/* Only async-signal-safe calls in here, so no printf */
+static void report(int sig)
+{
+    unsigned long n = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    char buf[32];
+    int i = sizeof(buf);
+
+    buf[--i] = '\n';
+    do
+    {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    if (report_fd >= 0)
+        write(report_fd, buf + i, sizeof(buf) - i);
+}
+
+__attribute__((constructor))
+static void setup()
+{
+    const char* file = getenv("MALLOC_COUNT_FILE");
+    struct sigaction sa;
+
+    if (file == NULL)
+        return;
+    report_fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = report;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Throughput against the number of worker processes (-w) sharing one
+# seat map, on a mix of seat map reads, holds and a static file. Without
+# worker counts it doubles from 1 up to the number of cores.
+#
+#   bench/scale_workers.sh [seconds] [connections] [workers...]
+#
+# Run from the top of the tree; the server serves files from there.
+# The load generator shares the machine, so leave it a core or two.
+
+SECONDS_PER_RUN=${1:-10}
+CONNECTIONS=${2:-32}
+PORT=8092
+SEATS=1000
+PATHS="/list_seats /view_seat?seat=7&user=1 /view_seat?seat=9&user=2 /selectSeats.html"
+
+[ $# -gt 2 ] && shift 2 && WORKERS="$*"
+if [ -z "$WORKERS" ]
+then
+    n=1
+    while [ $n -le $(nproc) ]
+    do
+        WORKERS="$WORKERS $n"
+        n=$((n * 2))
+    done
+fi
+
+make -s http_server bench/loadgen || exit 1
+
+echo "$(nproc) cores, $CONNECTIONS connections, ${SECONDS_PER_RUN}s per run"
+for w in $WORKERS
+do
+    ./http_server -p $PORT -w $w $SEATS > /dev/null 2>&1 &
+    server=$!
+    sleep 1
+    if ! kill -0 $server 2> /dev/null
+    then
+        echo "workers $w: server did not start"
+        continue
+    fi
+    printf "workers %-3d " $w
+    bench/loadgen -p $PORT -c $CONNECTIONS -d $SECONDS_PER_RUN $PATHS
+    # the supervisor passes the signal on to its workers
+    kill -INT $server
+    wait $server 2> /dev/null
+done
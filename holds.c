@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "holds.h"
+#include "shared.h"
+
+#define CUSTOMER_SHARDS 64      // independent locks, must be a power of two
+
+/**
+ *  @struct customer_t
+ *  @brief a customer with at least one seat; seats are chained through
+ *         seat_t's holder_prev/holder_next
+ */
+typedef struct customer_struct
+{
+    int customer_id;
+    int held;                   // how many of the seats are PENDING
+    seat_t* seats;
+    struct customer_struct* next;
+} customer_t;
+
+/**
+ *  @struct customer_shard_t
+ *  @brief hash chains of the customers whose id maps to this shard;
+ *         the lock covers them, their seat lists and those seats' states
+ */
+typedef struct customer_shard_struct
+{
+    pthread_mutex_t lock;
+    customer_t** buckets;
+    unsigned int mask;
+} customer_shard_t;
+
+/**
+ *  @struct holds_index_t
+ *  @brief the whole index; in shared memory when several workers
+ *         serve the seat map
+ *
+ *  Every customer holds a seat, so one pool entry per seat is always
+ *  enough. Entries are recycled through free_customers so holds never
+ *  malloc.
+ */
+typedef struct holds_index_struct
+{
+    customer_shard_t shards[CUSTOMER_SHARDS];
+    customer_t* pool;
+    customer_t* free_customers;
+    pthread_mutex_t pool_lock;
+} holds_index_t;
+
+static holds_index_t* holds = NULL;
+static int max_held = 0;
+
+
+static unsigned int hash_customer(int customer_id)
+{
+    unsigned int h = (unsigned int) customer_id * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+static customer_shard_t* shard_of(int customer_id)
+{
+    return &holds->shards[hash_customer(customer_id) & (CUSTOMER_SHARDS - 1)];
+}
+
+static customer_t** bucket_of(customer_shard_t* shard, int customer_id)
+{
+    return &shard->buckets[(hash_customer(customer_id) / CUSTOMER_SHARDS) & shard->mask];
+}
+
+/* Called with the shard locked */
+static customer_t* find_customer(customer_shard_t* shard, int customer_id)
+{
+    customer_t* curr = *bucket_of(shard, customer_id);
+    while (curr != NULL && curr->customer_id != customer_id)
+        curr = curr->next;
+    return curr;
+}
+
+void holds_init(int number_of_seats, int hold_cap)
+{
+    unsigned int buckets = 16;
+    int i;
+
+    max_held = hold_cap > 0 ? hold_cap : 0;
+    holds = (holds_index_t*) shared_calloc(1, sizeof(holds_index_t));
+    shared_mutex_init(&holds->pool_lock);
+
+    while (buckets * CUSTOMER_SHARDS < (unsigned int) number_of_seats)
+        buckets *= 2;
+    for (i = 0; i < CUSTOMER_SHARDS; i++)
+    {
+        shared_mutex_init(&holds->shards[i].lock);
+        holds->shards[i].buckets = (customer_t**) shared_calloc(buckets, sizeof(customer_t*));
+        holds->shards[i].mask = buckets - 1;
+    }
+
+    holds->pool = (customer_t*) shared_calloc(number_of_seats, sizeof(customer_t));
+    holds->free_customers = NULL;
+    for (i = 0; i < number_of_seats; i++)
+    {
+        holds->pool[i].next = holds->free_customers;
+        holds->free_customers = &holds->pool[i];
+    }
+}
+
+void holds_destroy()
+{
+    int i;
+    for (i = 0; i < CUSTOMER_SHARDS; i++)
+        shared_free(holds->shards[i].buckets);
+    shared_free(holds->pool);
+    shared_free(holds);
+    holds = NULL;
+}
+
+int holds_add(seat_t* seat, int customer_id, seat_state_t state, int enforce_cap)
+{
+    customer_shard_t* shard = shard_of(customer_id);
+    customer_t* customer;
+
+    shared_mutex_lock(&shard->lock);
+    customer = find_customer(shard, customer_id);
+    if (customer == NULL)
+    {
+        customer_t** bucket = bucket_of(shard, customer_id);
+
+        shared_mutex_lock(&holds->pool_lock);
+        customer = holds->free_customers;
+        holds->free_customers = customer->next;
+        pthread_mutex_unlock(&holds->pool_lock);
+
+        customer->customer_id = customer_id;
+        customer->held = 0;
+        customer->seats = NULL;
+        customer->next = *bucket;
+        *bucket = customer;
+    }
+    else if (enforce_cap && state == PENDING && max_held > 0 && customer->held >= max_held)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+
+    seat->customer_id = customer_id;
+    seat->state = state;
+    if (state == PENDING)
+        customer->held++;
+    seat->holder_prev = NULL;
+    seat->holder_next = customer->seats;
+    if (customer->seats != NULL)
+        customer->seats->holder_prev = seat;
+    customer->seats = seat;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+void holds_remove(seat_t* seat)
+{
+    customer_shard_t* shard = shard_of(seat->customer_id);
+    customer_t* customer;
+
+    shared_mutex_lock(&shard->lock);
+    customer = find_customer(shard, seat->customer_id);
+    if (customer != NULL)
+    {
+        if (seat->holder_prev != NULL)
+            seat->holder_prev->holder_next = seat->holder_next;
+        else
+            customer->seats = seat->holder_next;
+        if (seat->holder_next != NULL)
+            seat->holder_next->holder_prev = seat->holder_prev;
+        if (seat->state == PENDING)
+            customer->held--;
+
+        if (customer->seats == NULL)
+        {
+            // last seat gone, hand the entry back to the pool
+            customer_t** link = bucket_of(shard, customer->customer_id);
+            while (*link != customer)
+                link = &(*link)->next;
+            *link = customer->next;
+
+            shared_mutex_lock(&holds->pool_lock);
+            customer->next = holds->free_customers;
+            holds->free_customers = customer;
+            pthread_mutex_unlock(&holds->pool_lock);
+        }
+    }
+    seat->holder_prev = NULL;
+    seat->holder_next = NULL;
+    seat->state = AVAILABLE;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void holds_confirm(seat_t* seat)
+{
+    customer_shard_t* shard = shard_of(seat->customer_id);
+    customer_t* customer;
+
+    shared_mutex_lock(&shard->lock);
+    customer = find_customer(shard, seat->customer_id);
+    if (customer != NULL && seat->state == PENDING)
+        customer->held--;
+    seat->state = OCCUPIED;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int holds_list(char* buf, int bufsize, int customer_id)
+{
+    customer_shard_t* shard = shard_of(customer_id);
+    customer_t* customer;
+    seat_t* curr;
+    int index = 0, count = 0;
+
+    buf[0] = '\0';
+    shared_mutex_lock(&shard->lock);
+    customer = find_customer(shard, customer_id);
+    for (curr = customer ? customer->seats : NULL; curr != NULL && index < bufsize; curr = curr->holder_next)
+    {
+        index += snprintf(buf+index, bufsize-index, "%d %c,",
+                curr->id, seat_state_to_char(curr->state));
+        count++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return count;
+}
+
+int holds_first_pending(int customer_id)
+{
+    customer_shard_t* shard = shard_of(customer_id);
+    customer_t* customer;
+    seat_t* curr;
+    int seat_id = -1;
+
+    shared_mutex_lock(&shard->lock);
+    customer = find_customer(shard, customer_id);
+    if (customer != NULL && customer->held > 0)
+    {
+        for (curr = customer->seats; curr != NULL; curr = curr->holder_next)
+        {
+            if (curr->state == PENDING)
+            {
+                seat_id = curr->id;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return seat_id;
+}
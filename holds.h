@@ -0,0 +1,57 @@
+#ifndef _HOLDS_H_
+#define _HOLDS_H_
+
+#include "seats.h"
+
+/*
+ * Secondary index from customer id to the seats that customer holds
+ * (PENDING) or owns (OCCUPIED). A seat's state only moves in or out of
+ * AVAILABLE, or from PENDING to OCCUPIED, through these functions, and
+ * always with that seat locked.
+ */
+
+/**
+ * @function holds_init
+ * @param number_of_seats Bounds how many customers can hold seats.
+ * @param hold_cap        Most PENDING seats per customer, 0 = no limit.
+ */
+void holds_init(int number_of_seats, int hold_cap);
+void holds_destroy();
+
+/**
+ * @function holds_add
+ * @brief Gives an AVAILABLE seat to customer_id in state PENDING or
+ *        OCCUPIED and files it under that customer.
+ * @param enforce_cap Refuse a PENDING seat past the hold cap.
+ * @return 0, or -1 (seat untouched) if the customer is at the hold cap
+ */
+int holds_add(seat_t* seat, int customer_id, seat_state_t state, int enforce_cap);
+
+/**
+ * @function holds_remove
+ * @brief Takes a held or owned seat out of its customer's list and makes
+ *        it AVAILABLE again. customer_id is left as it was.
+ */
+void holds_remove(seat_t* seat);
+
+/**
+ * @function holds_confirm
+ * @brief Moves a seat from PENDING to OCCUPIED for the same customer.
+ */
+void holds_confirm(seat_t* seat);
+
+/**
+ * @function holds_list
+ * @brief Writes a customer's seats as "%d %c," entries.
+ * @return number of seats listed
+ */
+int holds_list(char* buf, int bufsize, int customer_id);
+
+/**
+ * @function holds_first_pending
+ * @brief A seat the customer currently holds, or -1 if none. The seat
+ *        is not locked; check it again after locking.
+ */
+int holds_first_pending(int customer_id);
+
+#endif
@@ -10,15 +10,33 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 
 #include "thread_pool.h"
 #include "seats.h"
+#include "seat_events.h"
+#include "admission.h"
+#include "uring_server.h"
+#include "replication.h"
+#include "trace.h"
+#include "waitlist.h"
+#include "assets.h"
+#include "shared.h"
 #include "util.h"
 
 #define BUFSIZE 1024
 #define FILENAMESIZE 100
+#define MAX_PARKED 1024     // connections waiting on seat waitlists
+#define PARK_TIMEOUT 30     // seconds a connection may wait for a seat
+#define SHARED_BASE (4*1024*1024)   // shared memory for -w besides the seats
+#define SHARED_PER_SEAT 512
 
 void shutdown_server(int);
+void usage(char*);
+void supervise(int);
 
 int listenfd;
 threadpool_t* threadpool;
@@ -28,6 +46,28 @@ int main(int argc,char *argv[])
     int flag, num_seats = 20;
     int connfd = 0;
     struct sockaddr_in serv_addr;
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+    int opt;
+
+    // admission control: per-client rate limit and queue-depth shedding
+    int rate_limit = 0, rate_burst = 20, shed_depth = 50;
+    bool use_uring = false;
+
+    // replication: address and port to serve replicas on, primary to follow
+    char* replication_host = NULL;
+    int replication_port = 0;
+    char* primary = NULL;
+    char* colon;
+
+    // trace one request in trace_every, 0 = off
+    int trace_every = 0;
+
+    // most seats one customer may hold at once, 0 = no limit
+    int hold_cap = 0;
+
+    // worker processes sharing one seat map, 0 = serve from this process
+    int num_workers = 0;
 
     char send_buffer[BUFSIZE];
     
@@ -35,9 +75,55 @@ int main(int argc,char *argv[])
 
     int server_port = 8080;
 
-    if (argc > 1)
+    while ((opt = getopt(argc, argv, "p:r:b:q:uR:P:s:H:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                server_port = atoi(optarg);
+                break;
+            case 'r':
+                rate_limit = atoi(optarg);
+                break;
+            case 'b':
+                rate_burst = atoi(optarg);
+                break;
+            case 'q':
+                shed_depth = atoi(optarg);
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'R':
+                // [address:]port, loopback only unless an address is given
+                if ((colon = strchr(optarg, ':')) != NULL)
+                {
+                    *colon = '\0';
+                    replication_host = optarg;
+                    optarg = colon + 1;
+                }
+                replication_port = atoi(optarg);
+                break;
+            case 'P':
+                primary = optarg;
+                break;
+            case 's':
+                trace_every = atoi(optarg);
+                break;
+            case 'H':
+                hold_cap = atoi(optarg);
+                break;
+            case 'w':
+                num_workers = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind < argc)
     {
-        num_seats = atoi(argv[1]);
+        num_seats = atoi(argv[optind]);
     } 
 
     if (server_port < 1500)
@@ -49,6 +135,36 @@ int main(int argc,char *argv[])
     if (signal(SIGINT, shutdown_server) == SIG_ERR) 
         printf("Issue registering SIGINT handler");
 
+    // writes to clients that went away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    if (num_workers > 0 && (primary != NULL || replication_port > 0))
+    {
+        fprintf(stderr, "Replication is not supported with worker processes\n");
+        exit(-1);
+    }
+
+    // everything the workers share has to exist before they are forked
+    if (num_workers > 0 &&
+            shared_init((size_t) num_seats * SHARED_PER_SEAT + SHARED_BASE) != 0)
+        exit(-1);
+
+    admission_init(rate_limit, rate_burst, shed_depth);
+
+    // static files, with their gzip/brotli variants built once here
+    assets_init();
+
+    // Load the seats;
+    seats_set_hold_cap(hold_cap);
+    load_seats(num_seats); //TODO read from argv
+
+    // only returns in a worker, the supervisor stays there respawning them
+    if (num_workers > 0)
+        supervise(num_workers);
+
+    // before any thread starts, they all have to leave SIGUSR2 to the tracer
+    trace_init(trace_every);
+
     listenfd = socket(AF_INET, SOCK_STREAM, 0);
     if ( listenfd < 0 ){
         perror("Socket");
@@ -57,15 +173,37 @@ int main(int argc,char *argv[])
     printf("Established Socket: %d\n", listenfd);
     flag = 1;
     setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag) );
+    // every worker listens on the port, the kernel spreads connections
+    if (num_workers > 0)
+        setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag) );
 
     // initialize the threadpool
     // Set the number of threads and size of the queue
     
     threadpool = threadpool_create(10,50);
 
+    // connections that can wait for a held seat at once
+    waitlist_init(num_seats, MAX_PARKED, PARK_TIMEOUT);
 
-    // Load the seats;
-    load_seats(num_seats); //TODO read from argv
+    // start pushing seat changes to /seat_events subscribers
+    if (seat_events_init(num_seats) != 0)
+        fprintf(stderr, "Could not start seat event publisher\n");
+
+    // pick up what the other workers do to the seats
+    if (num_workers > 0 && seats_watch_workers() != 0)
+        fprintf(stderr, "Could not watch the other workers\n");
+
+    if (primary != NULL)
+    {
+        char* port = strchr(primary, ':');
+        if (port == NULL)
+            usage(argv[0]);
+        *port = '\0';
+        if (replication_follow(num_seats, primary, atoi(port+1)) != 0)
+            exit(-1);
+    }
+    if (replication_port > 0 && replication_listen(num_seats, replication_host, replication_port) != 0)
+        exit(-1);
 
     // set server address 
     memset(&serv_addr, '0', sizeof(serv_addr));
@@ -82,21 +220,157 @@ int main(int argc,char *argv[])
     }
 
     // listen for incoming requests
-    listen(listenfd, 10);
+    listen(listenfd, SOMAXCONN);
+
+    // io_uring drives every connection from this thread; only returns
+    // if the kernel cannot do it, then the thread pool takes over
+    if (use_uring && uring_server_run(listenfd) != 0)
+        fprintf(stderr, "io_uring unavailable, using the thread pool\n");
 
     // handle connections loop (forever)
     while(1)
     {
-        connfd = accept(listenfd, (struct sockaddr*)NULL, NULL);
-        
-        // single threaded
-        threadpool_add_task(threadpool, handle_connection_wrapper, (void*) &connfd);
+        client_len = sizeof(client_addr);
+        connfd = accept(listenfd, (struct sockaddr*) &client_addr, &client_len);
+        if (connfd < 0)
+            continue;
+        uint64_t accepted_at = trace_now();
+        uint32_t request_id = trace_sample();
+        trace_set_request(request_id);
+
+        // push back before a worker is spent on the request
+        admission_t verdict = admission_check(client_addr.sin_addr.s_addr,
+                threadpool_queue_depth(threadpool));
+        trace_span("accept", accepted_at);
+        if (verdict != ADMIT)
+        {
+            admission_reject(connfd, verdict);
+            continue;
+        }
+
+        // the fd and the trace id travel by value, connfd is reused by the next accept
+        uint64_t enqueued_at = trace_now();
+        uint64_t task = ((uint64_t) request_id << 32) | (uint32_t) connfd;
+        trace_async_begin("queued", request_id);
+        if (threadpool_add_task(threadpool, handle_connection_wrapper, (void*) (uintptr_t) task) != 0)
+        {
+            trace_async_end("queued", request_id);
+            admission_reject(connfd, SHED);
+        }
+        trace_span("enqueue", enqueued_at);
+    }
+}
+
+void usage(char* prog)
+{
+    fprintf(stderr, "usage: %s [-p port] [-r requests/sec per client] [-b burst] "
+            "[-q shed queue depth] [-u use io_uring] [-R [address:]replication port] "
+            "[-P primary host:port] [-s trace one request in N] "
+            "[-H seats one customer may hold] [-w worker processes] [num_seats]\n", prog);
+    exit(-1);
+}
+
+static pid_t* workers;
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_supervisor(int signo)
+{
+    stopping = 1;
+}
+
+static pid_t spawn_worker()
+{
+    pid_t pid;
+
+    // unflushed output would be printed once more by the child
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        // a worker goes down with its supervisor
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        signal(SIGINT, shutdown_server);
+        signal(SIGTERM, SIG_DFL);
+        printf("Worker %d started\n", (int) getpid());
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
     }
+    return pid;
+}
+
+/*
+ * Fork count workers over the shared seat map and keep them running.
+ * Returns only in the workers; the supervisor waits here, replaces
+ * workers that die and takes them all down on SIGINT or SIGTERM. Locks
+ * a dead worker held are recovered by the next process to take them.
+ */
+void supervise(int count)
+{
+    struct sigaction sa;
+    time_t* started;
+    int i;
+
+    // no SA_RESTART, waitpid has to return to notice the signal
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_supervisor;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    workers = (pid_t*) calloc(count, sizeof(pid_t));
+    started = (time_t*) calloc(count, sizeof(time_t));
+    for (i = 0; i < count; i++)
+    {
+        if ((workers[i] = spawn_worker()) == 0)
+            return;
+        started[i] = time(NULL);
+    }
+    printf("Supervising %d workers\n", count);
+
+    while (!stopping)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < count && workers[i] != pid; i++)
+            ;
+        if (i == count || stopping)
+            continue;
+
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "Worker %d killed by signal %d, restarting\n", (int) pid, WTERMSIG(status));
+        else
+            fprintf(stderr, "Worker %d exited with %d, restarting\n", (int) pid, WEXITSTATUS(status));
+        // one that cannot even start would be respawned in a tight loop
+        if (time(NULL) - started[i] < 1)
+            sleep(1);
+        if ((workers[i] = spawn_worker()) == 0)
+            return;
+        started[i] = time(NULL);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (workers[i] > 0)
+            kill(workers[i], SIGTERM);
+    }
+    while (wait(NULL) > 0)
+        ;
+    exit(0);
 }
 
 void shutdown_server(int signo){
     threadpool_destroy(threadpool);
+    seat_events_shutdown();
+    waitlist_destroy();
     unload_seats();
+    assets_destroy();
     close(listenfd);
     exit(0);
 }
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "replication.h"
+#include "seats.h"
+
+#define HEARTBEAT_MS 1000
+#define ACK_TIMEOUT_SEC 5
+#define RETRY_SEC 1
+#define LINE_SIZE 64
+#define UPDATE_LINE_SIZE 32     // "%d %c %d\n"
+
+/*
+ * Wire format, one text line per record:
+ *
+ *   primary -> replica   SNAPSHOT <version> <count>   (every seat follows)
+ *                        DELTA <version> <count>      (changed seats follow)
+ *                        <seat id> <A|P|O> <customer id>
+ *   replica -> primary   ACK <version>
+ *
+ * The primary waits for the ACK before sending the next batch, so
+ * everything that changes meanwhile goes out together. An empty DELTA
+ * is sent when nothing changed for HEARTBEAT_MS.
+ */
+
+/**
+ *  @struct replica_t
+ *  @brief a replica connected to this primary
+ *
+ *  @var acked Last primary version the replica confirmed it applied.
+ */
+typedef struct replica_struct
+{
+    int fd;
+    char addr[INET_ADDRSTRLEN];
+    unsigned long acked;
+    struct replica_struct* next;
+} replica_t;
+
+static int num_seats;
+
+/* Primary side */
+static pthread_mutex_t replicas_lock = PTHREAD_MUTEX_INITIALIZER;
+static replica_t* replicas = NULL;
+static int replication_fd = -1;
+static pthread_t listener;
+
+/* Replica side, protected by follow_lock */
+static pthread_mutex_t follow_lock = PTHREAD_MUTEX_INITIALIZER;
+static int following = 0;
+static int promoted = 0;
+static int primary_fd = -1;
+static struct sockaddr_in primary_addr;
+static unsigned long primary_version = 0;
+static pthread_t follower;
+
+
+static int write_all(int fd, char* buf, int len)
+{
+    int sent = 0;
+    while (sent < len)
+    {
+        int rc = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        sent += rc;
+    }
+    return sent;
+}
+
+static void* replica_sender(void* arg)
+{
+    replica_t* r = (replica_t*) arg;
+    int msg_size = num_seats * UPDATE_LINE_SIZE + LINE_SIZE;
+    seat_update_t* updates = (seat_update_t*) malloc(sizeof(seat_update_t) * num_seats);
+    char* msg = (char*) malloc(msg_size);
+    FILE* in = fdopen(dup(r->fd), "r");
+    struct timeval timeout = { ACK_TIMEOUT_SEC, 0 };
+    char line[LINE_SIZE];
+    unsigned long sent = 0, version, acked;
+    int snapshot = 1;
+    int count, len, i;
+
+    // a replica that stops acknowledging is dropped
+    setsockopt(r->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (updates != NULL && msg != NULL && in != NULL)
+    {
+        if (!snapshot)
+        {
+            seats_wait_for_change(sent, HEARTBEAT_MS);
+            count = seats_changes_since(sent, updates, num_seats, &version);
+            if (count < 0)
+                snapshot = 1;
+        }
+        if (snapshot)
+            count = seats_snapshot(updates, num_seats, &version);
+
+        len = snprintf(msg, msg_size, "%s %lu %d\n",
+                snapshot ? "SNAPSHOT" : "DELTA", version, count);
+        for (i = 0; i < count; i++)
+        {
+            len += snprintf(msg + len, msg_size - len, "%d %c %d\n", updates[i].id,
+                    seat_state_to_char(updates[i].state), updates[i].customer_id);
+        }
+        if (write_all(r->fd, msg, len) < 0)
+            break;
+
+        if (fgets(line, sizeof(line), in) == NULL || sscanf(line, "ACK %lu", &acked) != 1)
+            break;
+        pthread_mutex_lock(&replicas_lock);
+        r->acked = acked;
+        pthread_mutex_unlock(&replicas_lock);
+
+        sent = version;
+        snapshot = 0;
+    }
+    printf("Replica %s disconnected\n", r->addr);
+
+    pthread_mutex_lock(&replicas_lock);
+    replica_t** curr = &replicas;
+    while (*curr != NULL && *curr != r)
+        curr = &(*curr)->next;
+    if (*curr != NULL)
+        *curr = r->next;
+    pthread_mutex_unlock(&replicas_lock);
+
+    if (in != NULL)
+        fclose(in);
+    close(r->fd);
+    free(updates);
+    free(msg);
+    free(r);
+    return NULL;
+}
+
+static void* replication_accept_loop(void* arg)
+{
+    while (1)
+    {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        pthread_t sender;
+        replica_t* r;
+        int fd = accept(replication_fd, (struct sockaddr*) &addr, &addr_len);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("replication accept");
+            return NULL;
+        }
+
+        r = (replica_t*) calloc(1, sizeof(replica_t));
+        if (r == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        r->fd = fd;
+        inet_ntop(AF_INET, &addr.sin_addr, r->addr, sizeof(r->addr));
+        printf("Replica %s connected\n", r->addr);
+
+        pthread_mutex_lock(&replicas_lock);
+        r->next = replicas;
+        replicas = r;
+        pthread_mutex_unlock(&replicas_lock);
+
+        // one sender per replica; there are only ever a handful
+        if (pthread_create(&sender, NULL, replica_sender, r) != 0)
+        {
+            pthread_mutex_lock(&replicas_lock);
+            replicas = r->next;
+            pthread_mutex_unlock(&replicas_lock);
+            close(fd);
+            free(r);
+            continue;
+        }
+        pthread_detach(sender);
+    }
+}
+
+int replication_listen(int number_of_seats, char* host, int port)
+{
+    struct sockaddr_in addr;
+    int flag = 1;
+
+    num_seats = number_of_seats;
+    replication_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (replication_fd < 0)
+    {
+        perror("replication socket");
+        return -1;
+    }
+    setsockopt(replication_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    // a replica gets every seat and customer, so only this host by default
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (host != NULL && inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid replication address %s\n", host);
+        close(replication_fd);
+        replication_fd = -1;
+        return -1;
+    }
+    if (bind(replication_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+            || listen(replication_fd, 10) != 0)
+    {
+        perror("replication bind");
+        close(replication_fd);
+        replication_fd = -1;
+        return -1;
+    }
+
+    if (pthread_create(&listener, NULL, replication_accept_loop, NULL) != 0)
+        return -1;
+    printf("Accepting replicas on %s:%d\n", host ? host : "127.0.0.1", port);
+    return 0;
+}
+
+/*
+ * Apply batches from one connection to the primary until it breaks.
+ */
+static void follow_connection(int fd, seat_update_t* updates)
+{
+    FILE* in = fdopen(fd, "r");
+    char line[LINE_SIZE];
+    char kind[16];
+    unsigned long version;
+    int count, i;
+
+    if (in == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        if (sscanf(line, "%15s %lu %d", kind, &version, &count) != 3
+                || count < 0 || count > num_seats)
+            break;
+
+        for (i = 0; i < count; i++)
+        {
+            char state;
+            if (fgets(line, sizeof(line), in) == NULL
+                    || sscanf(line, "%d %c %d", &updates[i].id, &state, &updates[i].customer_id) != 3)
+                break;
+            updates[i].state = char_to_seat_state(state);
+        }
+        if (i < count)
+            break;
+
+        seats_apply(updates, count);
+
+        pthread_mutex_lock(&follow_lock);
+        primary_version = version;
+        pthread_mutex_unlock(&follow_lock);
+
+        snprintf(line, sizeof(line), "ACK %lu\n", version);
+        if (write_all(fd, line, strlen(line)) < 0)
+            break;
+    }
+    fclose(in);
+}
+
+static void* follower_loop(void* arg)
+{
+    seat_update_t* updates = (seat_update_t*) malloc(sizeof(seat_update_t) * num_seats);
+
+    while (updates != NULL)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        pthread_mutex_lock(&follow_lock);
+        if (!following)
+        {
+            pthread_mutex_unlock(&follow_lock);
+            if (fd >= 0)
+                close(fd);
+            break;
+        }
+        primary_fd = fd;
+        pthread_mutex_unlock(&follow_lock);
+
+        if (fd >= 0 && connect(fd, (struct sockaddr*) &primary_addr, sizeof(primary_addr)) == 0)
+        {
+            printf("Following primary %s:%d\n", inet_ntoa(primary_addr.sin_addr),
+                    ntohs(primary_addr.sin_port));
+            follow_connection(fd, updates);
+        }
+        else if (fd >= 0)
+            close(fd);
+
+        pthread_mutex_lock(&follow_lock);
+        primary_fd = -1;
+        pthread_mutex_unlock(&follow_lock);
+
+        // keep retrying until promoted; the primary may just be restarting
+        sleep(RETRY_SEC);
+    }
+    free(updates);
+    return NULL;
+}
+
+int replication_follow(int number_of_seats, char* host, int port)
+{
+    num_seats = number_of_seats;
+
+    memset(&primary_addr, 0, sizeof(primary_addr));
+    primary_addr.sin_family = AF_INET;
+    primary_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &primary_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid primary address: %s\n", host);
+        return -1;
+    }
+
+    seats_set_read_only(1);
+    following = 1;
+    if (pthread_create(&follower, NULL, follower_loop, NULL) != 0)
+    {
+        following = 0;
+        seats_set_read_only(0);
+        return -1;
+    }
+    return 0;
+}
+
+void replication_promote()
+{
+    pthread_mutex_lock(&follow_lock);
+    if (!following)
+    {
+        pthread_mutex_unlock(&follow_lock);
+        return;
+    }
+    following = 0;
+    // unblock the follower if it is waiting on the primary
+    if (primary_fd >= 0)
+        shutdown(primary_fd, SHUT_RDWR);
+    pthread_mutex_unlock(&follow_lock);
+
+    // no batch from the old primary may land after local writes start
+    pthread_join(follower, NULL);
+    promoted = 1;
+    seats_set_read_only(0);
+    printf("Promoted to primary\n");
+}
+
+void replication_stats(char* buf, int bufsize)
+{
+    int index;
+    replica_t* curr;
+
+    pthread_mutex_lock(&follow_lock);
+    if (following)
+        index = snprintf(buf, bufsize, "role replica\nprimary_version %lu\n", primary_version);
+    else
+        index = snprintf(buf, bufsize, "role %s\n", promoted ? "promoted" : "primary");
+    pthread_mutex_unlock(&follow_lock);
+
+    pthread_mutex_lock(&replicas_lock);
+    for (curr = replicas; curr != NULL && index < bufsize; curr = curr->next)
+        index += snprintf(buf + index, bufsize - index, "replica_%s_acked %lu\n",
+                curr->addr, curr->acked);
+    pthread_mutex_unlock(&replicas_lock);
+}
@@ -0,0 +1,43 @@
+#ifndef _REPLICATION_H_
+#define _REPLICATION_H_
+
+/**
+ * @function replication_listen
+ * @brief Accepts replicas on the given port and streams every seat
+ *        transition to each of them: a snapshot first, then batches of
+ *        changes, each acknowledged before the next one is sent.
+ * @param number_of_seats Size of the seat map, bounds a batch.
+ * @param host            IPv4 address to listen on. NULL means loopback
+ *                        only; replicas see every seat and customer id.
+ * @param port            TCP port replicas connect to.
+ * @return 0 if all goes well, -1 otherwise
+ */
+int replication_listen(int number_of_seats, char* host, int port);
+
+/**
+ * @function replication_follow
+ * @brief Turns this server into a read-only replica of the primary at
+ *        host:port. Seat changes from the primary are applied locally;
+ *        view_seat, confirm and cancel are refused until promotion.
+ * @param number_of_seats Size of the seat map, must match the primary.
+ * @param host            IPv4 address of the primary.
+ * @param port            Replication port of the primary.
+ * @return 0 if all goes well, -1 otherwise
+ */
+int replication_follow(int number_of_seats, char* host, int port);
+
+/**
+ * @function replication_promote
+ * @brief Stops following the primary and starts taking seat changes
+ *        locally. Does nothing on a primary.
+ */
+void replication_promote();
+
+/**
+ * @function replication_stats
+ * @brief Formats the role and per-replica acknowledged versions as
+ *        "name value" lines.
+ */
+void replication_stats(char* buf, int bufsize);
+
+#endif
@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "seat_events.h"
+
+#define MAX_EVENTS 256
+#define KEEPALIVE_MS 15000
+#define MAX_BACKLOG (256*1024)
+
+/**
+ *  @struct subscriber_t
+ *  @brief one open /seat_events connection
+ *
+ *  @var fd      Client socket (non-blocking).
+ *  @var backlog Bytes the socket could not take yet; flushed on EPOLLOUT.
+ */
+typedef struct subscriber_struct
+{
+    int fd;
+    char* backlog;
+    int backlog_len;
+    struct subscriber_struct* prev;
+    struct subscriber_struct* next;
+} subscriber_t;
+
+static char* sse_headers = "HTTP/1.0 200 OK\r\n"\
+                           "Content-type: text/event-stream\r\n"\
+                           "Cache-Control: no-cache\r\n\r\n";
+static char* snapshot_framing = "event: snapshot\ndata: ";
+
+/* Shared with publishers, protected by events_lock */
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static int* dirty_ids;          // seats changed since the last delta
+static int dirty_count;
+static char* dirty_state;       // latest state char per seat, 0 if clean
+static subscriber_t* new_subscribers;
+static int running;
+
+/* Owned by the publisher thread */
+static subscriber_t* subscribers;
+static int num_seats;
+static char* event_buf;
+static int event_bufsize;
+static char* delta_buf;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static pthread_t publisher;
+
+static void* publisher_loop(void*);
+
+
+int seat_events_init(int number_of_seats)
+{
+    struct epoll_event ev;
+
+    num_seats = number_of_seats;
+    // the snapshot is the biggest event: headers, framing and the whole map
+    event_bufsize = strlen(sse_headers) + strlen(snapshot_framing) + list_seats_bufsize() + 2;
+
+    dirty_ids = (int*) malloc(sizeof(int) * number_of_seats);
+    dirty_state = (char*) calloc(number_of_seats, 1);
+    event_buf = (char*) malloc(event_bufsize);
+    delta_buf = (char*) malloc(event_bufsize);
+    if (dirty_ids == NULL || dirty_state == NULL || event_buf == NULL || delta_buf == NULL)
+        return -1;
+    dirty_count = 0;
+
+    epoll_fd = epoll_create1(0);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (epoll_fd < 0 || wake_fd < 0)
+    {
+        perror("seat_events");
+        return -1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    running = 1;
+    if (pthread_create(&publisher, NULL, publisher_loop, NULL) != 0)
+    {
+        running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void wake_publisher()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("seat_events wake");
+}
+
+void seat_events_publish(int seat_id, seat_state_t state)
+{
+    int was_clean;
+
+    if (wake_fd < 0 || seat_id < 0 || seat_id >= num_seats)
+        return;
+
+    pthread_mutex_lock(&events_lock);
+    was_clean = (dirty_count == 0);
+    if (dirty_state[seat_id] == 0)
+        dirty_ids[dirty_count++] = seat_id;
+    dirty_state[seat_id] = seat_state_to_char(state);
+    pthread_mutex_unlock(&events_lock);
+
+    // the publisher drains everything at once, one wakeup per batch is enough
+    if (was_clean)
+        wake_publisher();
+}
+
+void seat_events_subscribe(int connfd)
+{
+    subscriber_t* sub;
+
+    if (wake_fd < 0 || (sub = (subscriber_t*) calloc(1, sizeof(subscriber_t))) == NULL)
+    {
+        close(connfd);
+        return;
+    }
+    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+    sub->fd = connfd;
+
+    pthread_mutex_lock(&events_lock);
+    sub->next = new_subscribers;
+    new_subscribers = sub;
+    pthread_mutex_unlock(&events_lock);
+
+    wake_publisher();
+}
+
+void seat_events_shutdown()
+{
+    if (!running)
+        return;
+    pthread_mutex_lock(&events_lock);
+    running = 0;
+    pthread_mutex_unlock(&events_lock);
+    wake_publisher();
+    pthread_join(publisher, NULL);
+}
+
+static void drop_subscriber(subscriber_t* sub)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sub->fd, NULL);
+    close(sub->fd);
+    if (sub->prev != NULL)
+        sub->prev->next = sub->next;
+    else
+        subscribers = sub->next;
+    if (sub->next != NULL)
+        sub->next->prev = sub->prev;
+    free(sub->backlog);
+    free(sub);
+}
+
+/*
+ * Send as much as the socket takes right now and keep the rest for
+ * EPOLLOUT. Events must never be split or reordered, so once there is
+ * a backlog everything is appended behind it.
+ * Returns -1 if the subscriber was dropped.
+ */
+static int subscriber_write(subscriber_t* sub, const char* data, int len)
+{
+    int sent = 0;
+    struct epoll_event ev;
+
+    if (sub->backlog_len == 0)
+    {
+        while (sent < len)
+        {
+            int rc = send(sub->fd, data + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (rc > 0)
+                sent += rc;
+            else if (rc < 0 && errno == EINTR)
+                continue;
+            else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            else
+            {
+                drop_subscriber(sub);
+                return -1;
+            }
+        }
+        if (sent == len)
+            return 0;
+    }
+
+    // slow reader: buffer up to MAX_BACKLOG, then give up on it
+    if (sub->backlog_len + len - sent > MAX_BACKLOG)
+    {
+        drop_subscriber(sub);
+        return -1;
+    }
+    char* grown = (char*) realloc(sub->backlog, sub->backlog_len + len - sent);
+    if (grown == NULL)
+    {
+        drop_subscriber(sub);
+        return -1;
+    }
+    memcpy(grown + sub->backlog_len, data + sent, len - sent);
+    sub->backlog = grown;
+    sub->backlog_len += len - sent;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+    ev.data.ptr = sub;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sub->fd, &ev);
+    return 0;
+}
+
+static void subscriber_flush(subscriber_t* sub)
+{
+    struct epoll_event ev;
+
+    while (sub->backlog_len > 0)
+    {
+        int rc = send(sub->fd, sub->backlog, sub->backlog_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc > 0)
+        {
+            memmove(sub->backlog, sub->backlog + rc, sub->backlog_len - rc);
+            sub->backlog_len -= rc;
+        }
+        else if (rc < 0 && errno == EINTR)
+            continue;
+        else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+        {
+            drop_subscriber(sub);
+            return;
+        }
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = sub;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sub->fd, &ev);
+}
+
+static void broadcast(const char* data, int len)
+{
+    subscriber_t* curr = subscribers;
+    while (curr != NULL)
+    {
+        subscriber_t* next = curr->next;
+        subscriber_write(curr, data, len);
+        curr = next;
+    }
+}
+
+/*
+ * Build "event: snapshot" from the current seat map. list_seats ends
+ * its output with a newline which SSE would read as end of event.
+ */
+static int format_snapshot(char* buf, int bufsize)
+{
+    int index = snprintf(buf, bufsize, "%s%s", sse_headers, snapshot_framing);
+    // no room for the map and the closing blank line, send nothing
+    if (index + 2 >= bufsize)
+        return 0;
+    list_seats(buf + index, bufsize - index - 2);
+    index += strlen(buf + index);
+    while (index > 0 && buf[index-1] == '\n')
+        index--;
+    index += snprintf(buf + index, bufsize - index, "\n\n");
+    return index;
+}
+
+static void* publisher_loop(void* arg)
+{
+    struct epoll_event events[MAX_EVENTS];
+    subscriber_t* joining;
+    int delta_len;
+    int i, n;
+
+    while (1)
+    {
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, KEEPALIVE_MS);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("seat_events epoll_wait");
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            subscriber_t* sub = (subscriber_t*) events[i].data.ptr;
+            if (sub == NULL)
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("seat_events read");
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                // subscribers never send anything after the request; EOF means gone
+                char discard[256];
+                int rc = recv(sub->fd, discard, sizeof(discard), MSG_DONTWAIT);
+                if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    drop_subscriber(sub);
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLOUT)
+                subscriber_flush(sub);
+        }
+
+        /* Take the pending deltas and joiners in one go. Anything published
+           after this point waits for the next round, so a snapshot taken
+           below already covers every delta we are about to drop. */
+        pthread_mutex_lock(&events_lock);
+        if (!running)
+        {
+            pthread_mutex_unlock(&events_lock);
+            break;
+        }
+        delta_len = 0;
+        if (dirty_count > 0)
+        {
+            delta_len = snprintf(delta_buf, event_bufsize, "event: delta\ndata: ");
+            for (i = 0; i < dirty_count; i++)
+            {
+                int id = dirty_ids[i];
+                delta_len += snprintf(delta_buf + delta_len, event_bufsize - delta_len,
+                        "%d %c,", id, dirty_state[id]);
+                dirty_state[id] = 0;
+            }
+            dirty_count = 0;
+            // replace the trailing ',' with the end of event
+            delta_len += snprintf(delta_buf + delta_len - 1, event_bufsize - delta_len + 1, "\n\n") - 1;
+        }
+        joining = new_subscribers;
+        new_subscribers = NULL;
+        pthread_mutex_unlock(&events_lock);
+
+        if (delta_len > 0)
+            broadcast(delta_buf, delta_len);
+        else if (n == 0)
+            broadcast(":keepalive\n\n", strlen(":keepalive\n\n"));
+
+        if (joining != NULL)
+        {
+            int snapshot_len = format_snapshot(event_buf, event_bufsize);
+            while (joining != NULL)
+            {
+                subscriber_t* sub = joining;
+                struct epoll_event ev;
+                joining = joining->next;
+
+                sub->prev = NULL;
+                sub->next = subscribers;
+                if (subscribers != NULL)
+                    subscribers->prev = sub;
+                subscribers = sub;
+
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = sub;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sub->fd, &ev);
+                subscriber_write(sub, event_buf, snapshot_len);
+            }
+        }
+    }
+
+    while (subscribers != NULL)
+        drop_subscriber(subscribers);
+    return NULL;
+}
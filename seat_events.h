@@ -0,0 +1,41 @@
+#ifndef _SEAT_EVENTS_H_
+#define _SEAT_EVENTS_H_
+
+#include "seats.h"
+
+/**
+ * @function seat_events_init
+ * @brief Starts the publisher thread that fans seat changes out to
+ *        every /seat_events subscriber.
+ * @param number_of_seats Size of the seat map (seat ids are 0..n-1).
+ * @return 0 if all goes well, -1 otherwise
+ */
+int seat_events_init(int number_of_seats);
+
+/**
+ * @function seat_events_publish
+ * @brief Records that a seat changed state. Changes are coalesced per
+ *        seat and sent to subscribers as one delta event per wakeup.
+ *        Safe to call while holding the seat lock.
+ * @param seat_id Seat that changed.
+ * @param state   New state of the seat.
+ */
+void seat_events_publish(int seat_id, seat_state_t state);
+
+/**
+ * @function seat_events_subscribe
+ * @brief Hands a connection over to the publisher. The publisher sends
+ *        the event-stream headers and an initial snapshot, then keeps
+ *        the connection open for deltas. The caller must not close
+ *        connfd afterwards.
+ * @param connfd Client socket.
+ */
+void seat_events_subscribe(int connfd);
+
+/**
+ * @function seat_events_shutdown
+ * @brief Stops the publisher thread and closes every subscriber.
+ */
+void seat_events_shutdown();
+
+#endif
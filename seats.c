@@ -1,20 +1,85 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
 
 #include "seats.h"
+#include "shared.h"
+#include "seat_events.h"
+#include "holds.h"
+#include "waitlist.h"
+#include "trace.h"
+
+#define CHANGE_LOG_SIZE 1024
 
 seat_t* seat_header = NULL;
 
-char seat_state_to_char(seat_state_t);
+typedef struct seat_change_struct
+{
+    unsigned long version;
+    int seat_id;
+    int customer_id;
+    seat_state_t state;
+    pid_t origin;           // worker that made the change, 0 in a single process
+} seat_change_t;
+
+/* Seat map version and the most recent changes, protected by lock.
+   Entry v lives at log[v % CHANGE_LOG_SIZE]. Like the seats themselves
+   it is in shared memory when several workers serve the map. */
+typedef struct seat_versions_struct
+{
+    pthread_mutex_t lock;
+    uint32_t changes;       // bumped with every change, waiters sleep on it
+    uint32_t waiters;
+    unsigned long version;
+    seat_change_t log[CHANGE_LOG_SIZE];
+} seat_versions_t;
+
+static seat_versions_t* versions;
+static unsigned long* last_change;  // version of the latest change per seat
+static seat_t** seat_index;         // seat id -> seat
+static int seat_total = 0;
+static int read_only = 0;           // replicas only take seat changes from the primary
+static pid_t worker_pid = 0;        // tags this worker's change log entries
+static int hold_cap = 0;            // PENDING seats per customer, 0 = no limit
+
+static void seat_changed(seat_t* seat);
+
+/* Lock a seat for a request, tracing how long it waited for the lock */
+static uint64_t lock_seat(seat_t* seat)
+{
+    uint64_t start = trace_now();
+    shared_mutex_lock(&(seat->lock));
+    trace_span("seat_lock_wait", start);
+    return trace_now();
+}
+
+/* Unlock a seat taken with lock_seat, tracing how long it was held */
+static void unlock_seat(seat_t* seat, uint64_t locked_at)
+{
+    pthread_mutex_unlock(&(seat->lock));
+    trace_span("seat_lock_hold", locked_at);
+}
+
+/*
+ * Room for list_seats (or list_seats_since) of the whole map: at most
+ * "%d %c," per seat plus the version line.
+ */
+int list_seats_bufsize()
+{
+    return seat_total * 16 + 64;
+}
 
 void list_seats(char* buf, int bufsize)
 {
     seat_t* curr = seat_header;
     int index = 0;
+    uint64_t started_at = trace_now();
     while(curr != NULL && index < bufsize+ strlen("%d %c,"))
     {  /*LOCK*/
-        pthread_mutex_lock(&(curr->lock));
+        shared_mutex_lock(&(curr->lock));
         int length = snprintf(buf+index, bufsize-index, 
                 "%d %c,", curr->id, seat_state_to_char(curr->state));
         /*UNLOCK*/
@@ -27,121 +92,568 @@ void list_seats(char* buf, int bufsize)
         snprintf(buf+index-1, bufsize-index-1, "\n");
     else
         snprintf(buf, bufsize, "No seats not found\n\n");
+    // one span for the whole walk, not one per seat lock
+    trace_span("list_seats", started_at);
 }
 
-void view_seat(char* buf, int bufsize,  int seat_id, int customer_id, int customer_priority)
+/*
+ * The whole map in 2 bits per seat, seat i in bits 2*(i%4) of byte i/4
+ * (0 = A, 1 = P, 2 = O), base64 encoded after a "bitmap <seats>" line.
+ * 10000 seats come to about 3.3KB instead of ~60KB of "%d %c,".
+ */
+void list_seats_bitmap(char* buf, int bufsize)
 {
-    seat_t* curr = seat_header;
-    while(curr != NULL)
+    static const char base64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int index, i, j;
+    uint64_t started_at = trace_now();
+
+    index = snprintf(buf, bufsize, "bitmap %d\n", seat_total);
+    // 12 seats make 3 bytes make 4 characters
+    for(i = 0; i < seat_total && index + 5 < bufsize; i += 12)
     {
-        if(curr->id == seat_id)
-        { /*LOCK*/
- 	    pthread_mutex_lock(&(curr->lock));
-            if(curr->state == AVAILABLE || (curr->state == PENDING && curr->customer_id==customer_id))
-            { 
-                snprintf(buf, bufsize, "Confirm seat: %d %c ?\n\n",
-                        curr->id, seat_state_to_char(curr->state));
-                curr->state = PENDING;
-                curr->customer_id = customer_id;
-            }
-            else
-            {
-                snprintf(buf, bufsize, "Seat unavailable\n\n");
-            }
-        /*UNLOCK*/
-	pthread_mutex_unlock(&(curr->lock));
-            return;
+        unsigned int group = 0;
+        int bytes = (seat_total - i + 3) / 4;
+        if (bytes > 3)
+            bytes = 3;
+        for(j = 0; j < 12 && i + j < seat_total; j++)
+        {
+            seat_t* seat = seat_index[i + j];
+            shared_mutex_lock(&(seat->lock));
+            unsigned int state = seat->state == PENDING ? 1 : seat->state == OCCUPIED ? 2 : 0;
+            pthread_mutex_unlock(&(seat->lock));
+            // byte j/4 of the group is the most significant of the 24 bits
+            group |= state << ((2 - j / 4) * 8 + (j % 4) * 2);
         }
-        pthread_mutex_unlock(&(curr->lock));
-	curr = curr->next;
+        buf[index++] = base64[(group >> 18) & 63];
+        buf[index++] = base64[(group >> 12) & 63];
+        buf[index++] = bytes > 1 ? base64[(group >> 6) & 63] : '=';
+        buf[index++] = bytes > 2 ? base64[group & 63] : '=';
     }
-    snprintf(buf, bufsize, "Requested seat not found\n\n");
-    return;
+    snprintf(buf+index, bufsize-index, "\n");
+    trace_span("list_seats", started_at);
 }
 
-void confirm_seat(char* buf, int bufsize, int seat_id, int customer_id, int customer_priority)
+/*
+ * Write the seats changed after version `since` as "%d %c," entries,
+ * each seat once with its latest state. The first line carries the
+ * current version; if `since` is older than the change log (or from the
+ * future, e.g. before a restart) it is marked "resync" and the full map
+ * follows instead.
+ */
+void list_seats_since(char* buf, int bufsize, unsigned long since)
 {
-    seat_t* curr = seat_header;
-    while(curr != NULL)
+    unsigned long v, current;
+    int index;
+
+    shared_mutex_lock(&versions->lock);
+    current = versions->version;
+    if (since > current || current - since > CHANGE_LOG_SIZE)
     {
-        if(curr->id == seat_id)
-        { /*LOCK*/
-	    pthread_mutex_lock(&(curr->lock));
-            if(curr->state == PENDING && curr->customer_id == customer_id )
-            {
-                snprintf(buf, bufsize, "Seat confirmed: %d %c\n\n",
-                        curr->id, seat_state_to_char(curr->state));
-                curr->state = OCCUPIED;
-            }
-            else if(curr->customer_id != customer_id )
-            {
-                snprintf(buf, bufsize, "Permission denied - seat held by another user\n\n");
-            }
-            else if(curr->state != PENDING)
-            {
-                snprintf(buf, bufsize, "No pending request\n\n");
-            }
-/*UNLOCK*/
-	    pthread_mutex_unlock(&(curr->lock));
+        pthread_mutex_unlock(&versions->lock);
+        index = snprintf(buf, bufsize, "version %lu resync\n", current);
+        list_seats(buf+index, bufsize-index);
+        return;
+    }
+
+    index = snprintf(buf, bufsize, "version %lu\n", current);
+    for(v = since + 1; v <= current && index < bufsize; v++)
+    {
+        seat_change_t* change = &versions->log[v % CHANGE_LOG_SIZE];
+        // a later change to the same seat supersedes this one
+        if (last_change[change->seat_id] != v)
+            continue;
+        index += snprintf(buf+index, bufsize-index, "%d %c,",
+                change->seat_id, seat_state_to_char(change->state));
+    }
+    pthread_mutex_unlock(&versions->lock);
+
+    if (index >= bufsize)
+    {
+        // more changes than fit in one response, send the whole map
+        index = snprintf(buf, bufsize, "version %lu resync\n", current);
+        list_seats(buf+index, bufsize-index);
+        return;
+    }
+    if (buf[index-1] == ',')
+        index--;
+    snprintf(buf+index, bufsize-index, "\n");
+}
+
+/* Seats are never added or removed after load_seats, so no lock */
+static seat_t* find_seat(int seat_id)
+{
+    if (seat_id < 0 || seat_id >= seat_total)
+        return NULL;
+    return seat_index[seat_id];
+}
+
+/*
+ * Give a seat that was just released (locked, AVAILABLE) to the first
+ * waiter that may hold it and answer that waiter's parked connection.
+ */
+static void hand_off(seat_t* seat)
+{
+    char body[64];
+    int customer_id, fd;
+
+    while ((fd = waitlist_pop(seat->id, &customer_id)) != -1)
+    {
+        if (holds_add(seat, customer_id, PENDING, 1) == 0)
+        {
+            snprintf(body, sizeof(body), "Confirm seat: %d %c ?\n\n",
+                    seat->id, seat_state_to_char(AVAILABLE));
+            waitlist_notify(fd, body, true);
             return;
         }
-	pthread_mutex_unlock(&(curr->lock));
-        curr = curr->next;
+        waitlist_notify(fd, "Hold limit reached\n\n", false);
+    }
+}
+
+/*
+ * view_seat, except that with wait_fd >= 0 a seat pending for someone
+ * else parks the connection on the seat's waitlist. Returns 1 if it
+ * was parked, 0 if buf holds the answer.
+ */
+static int reserve_seat(char* buf, int bufsize, int seat_id, int customer_id, int customer_priority, int wait_fd)
+{
+    int parked = 0;
+
+    if (read_only)
+    {
+        snprintf(buf, bufsize, "Read-only replica\n\n");
+        return 0;
+    }
+    seat_t* curr = find_seat(seat_id);
+    if (curr == NULL)
+    {
+        snprintf(buf, bufsize, "Requested seat not found\n\n");
+        return 0;
+    }
+    /*LOCK*/
+    uint64_t locked_at = lock_seat(curr);
+    if(curr->state == AVAILABLE)
+    {
+        if (holds_add(curr, customer_id, PENDING, 1) == 0)
+        {
+            snprintf(buf, bufsize, "Confirm seat: %d %c ?\n\n",
+                    curr->id, seat_state_to_char(AVAILABLE));
+            seat_changed(curr);
+        }
+        else
+        {
+            snprintf(buf, bufsize, "Hold limit reached\n\n");
+        }
+    }
+    else if(curr->state == PENDING && curr->customer_id==customer_id)
+    {
+        snprintf(buf, bufsize, "Confirm seat: %d %c ?\n\n",
+                curr->id, seat_state_to_char(curr->state));
+        // already theirs, nothing to version or publish
     }
-    snprintf(buf, bufsize, "Requested seat not found\n\n");
-    
-    return;
+    else if(curr->state == PENDING && wait_fd >= 0 &&
+            waitlist_park(curr->id, customer_id, customer_priority, wait_fd) == 0)
+    {
+        // answered by hand_off once the holder lets go
+        parked = 1;
+    }
+    else
+    {
+        snprintf(buf, bufsize, "Seat unavailable\n\n");
+    }
+    /*UNLOCK*/
+    unlock_seat(curr, locked_at);
+    return parked;
+}
+
+void view_seat(char* buf, int bufsize,  int seat_id, int customer_id, int customer_priority)
+{
+    reserve_seat(buf, bufsize, seat_id, customer_id, customer_priority, -1);
+}
+
+/*
+ * view_seat for a client that would rather wait than poll: if the seat
+ * is pending for someone else, fd is queued (by priority, then arrival)
+ * and gets the seat as soon as it is cancelled. Returns 1 if fd now
+ * belongs to the waitlist, 0 if buf holds the answer.
+ */
+int wait_seat(char* buf, int bufsize, int seat_id, int customer_id, int customer_priority, int fd)
+{
+    return reserve_seat(buf, bufsize, seat_id, customer_id, customer_priority, fd);
+}
+
+void confirm_seat(char* buf, int bufsize, int seat_id, int customer_id, int customer_priority)
+{
+    if (read_only)
+    {
+        snprintf(buf, bufsize, "Read-only replica\n\n");
+        return;
+    }
+    seat_t* curr = find_seat(seat_id);
+    if (curr == NULL)
+    {
+        snprintf(buf, bufsize, "Requested seat not found\n\n");
+        return;
+    }
+    /*LOCK*/
+    uint64_t locked_at = lock_seat(curr);
+    if(curr->state == PENDING && curr->customer_id == customer_id )
+    {
+        snprintf(buf, bufsize, "Seat confirmed: %d %c\n\n",
+                curr->id, seat_state_to_char(curr->state));
+        holds_confirm(curr);
+        seat_changed(curr);
+        // confirmed seats are never released, nobody needs to wait
+        waitlist_drain(curr->id, "Seat unavailable\n\n");
+    }
+    else if(curr->customer_id != customer_id )
+    {
+        snprintf(buf, bufsize, "Permission denied - seat held by another user\n\n");
+    }
+    else if(curr->state != PENDING)
+    {
+        snprintf(buf, bufsize, "No pending request\n\n");
+    }
+    /*UNLOCK*/
+    unlock_seat(curr, locked_at);
 }
 
 void cancel(char* buf, int bufsize, int seat_id, int customer_id, int customer_priority)
 {
     printf("Cancelling seat %d for user %d\n", seat_id, customer_id);
 
-    seat_t* curr = seat_header;
-    while(curr != NULL)
+    if (read_only)
+    {
+        snprintf(buf, bufsize, "Read-only replica\n\n");
+        return;
+    }
+
+    seat_t* curr = find_seat(seat_id);
+    if (curr == NULL)
     {
-        if(curr->id == seat_id)
+        snprintf(buf, bufsize, "Seat not found\n\n");
+        return;
+    }
+    uint64_t locked_at = lock_seat(curr);
+    if(curr->state == PENDING && curr->customer_id == customer_id )
+    {
+        snprintf(buf, bufsize, "Seat request cancelled: %d %c\n\n",
+                curr->id, seat_state_to_char(curr->state));
+        holds_remove(curr);
+        hand_off(curr);
+        seat_changed(curr);
+    }
+    else if(curr->customer_id != customer_id )
+    {
+        snprintf(buf, bufsize, "Permission denied - seat held by another user\n\n");
+    }
+    else if(curr->state != PENDING)
+    {
+        snprintf(buf, bufsize, "No pending request\n\n");
+    }
+    unlock_seat(curr, locked_at);
+}
+
+/* Every seat the customer holds or owns, "%d %c," like list_seats */
+void my_seats(char* buf, int bufsize, int customer_id)
+{
+    uint64_t started_at = trace_now();
+    int length;
+
+    if (holds_list(buf, bufsize, customer_id) == 0)
+    {
+        snprintf(buf, bufsize, "No seats held\n\n");
+        return;
+    }
+    length = strlen(buf);
+    snprintf(buf+length-1, bufsize-length+1, "\n");
+    trace_span("my_seats", started_at);
+}
+
+/*
+ * Release every seat the customer still holds, e.g. when their session
+ * ends. Confirmed seats are kept. Each seat is locked and checked again
+ * since it can change hands between the lookup and the lock.
+ */
+void cancel_all(char* buf, int bufsize, int customer_id)
+{
+    int seat_id, count = 0;
+
+    if (read_only)
+    {
+        snprintf(buf, bufsize, "Read-only replica\n\n");
+        return;
+    }
+
+    while ((seat_id = holds_first_pending(customer_id)) != -1)
+    {
+        seat_t* curr = seat_index[seat_id];
+        uint64_t locked_at = lock_seat(curr);
+        if (curr->state == PENDING && curr->customer_id == customer_id)
         {
-	pthread_mutex_lock(&(curr->lock));
-            if(curr->state == PENDING && curr->customer_id == customer_id )
-            {
-             
-                snprintf(buf, bufsize, "Seat request cancelled: %d %c\n\n",
-                        curr->id, seat_state_to_char(curr->state));
-                curr->state = AVAILABLE;
-            }
-            else if(curr->customer_id != customer_id )
-            {
-                snprintf(buf, bufsize, "Permission denied - seat held by another user\n\n");
-            }
-            else if(curr->state != PENDING)
-            {
-                snprintf(buf, bufsize, "No pending request\n\n");
-            }
+            holds_remove(curr);
+            hand_off(curr);
+            seat_changed(curr);
+            count++;
+        }
+        unlock_seat(curr, locked_at);
+    }
+    printf("Cancelled %d seats for user %d\n", count, customer_id);
+    snprintf(buf, bufsize, "Seat requests cancelled: %d\n\n", count);
+}
 
-	    pthread_mutex_unlock(&(curr->lock));
-            return;
+void seats_set_hold_cap(int cap)
+{
+    hold_cap = cap;
+}
+
+/*
+ * Must be called with the seat locked so versions follow the order in
+ * which each seat's transitions happen.
+ */
+static void seat_changed(seat_t* seat)
+{
+    shared_mutex_lock(&versions->lock);
+    versions->version++;
+    versions->log[versions->version % CHANGE_LOG_SIZE].version = versions->version;
+    versions->log[versions->version % CHANGE_LOG_SIZE].seat_id = seat->id;
+    versions->log[versions->version % CHANGE_LOG_SIZE].customer_id = seat->customer_id;
+    versions->log[versions->version % CHANGE_LOG_SIZE].state = seat->state;
+    versions->log[versions->version % CHANGE_LOG_SIZE].origin = worker_pid;
+    last_change[seat->id] = versions->version;
+    pthread_mutex_unlock(&versions->lock);
+
+    __atomic_add_fetch(&versions->changes, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&versions->waiters, __ATOMIC_SEQ_CST) > 0)
+        shared_wake(&versions->changes);
+
+    seat_events_publish(seat->id, seat->state);
+}
+
+/*
+ * seats_changes_since, leaving out seats whose latest change was made
+ * by worker `skip` (0 skips nothing).
+ */
+static int collect_changes(unsigned long since, seat_update_t* updates, int max,
+        unsigned long* version, pid_t skip)
+{
+    unsigned long v;
+    int count = 0;
+
+    shared_mutex_lock(&versions->lock);
+    *version = versions->version;
+    if (since > versions->version || versions->version - since > CHANGE_LOG_SIZE)
+    {
+        pthread_mutex_unlock(&versions->lock);
+        return -1;
+    }
+    for(v = since + 1; v <= versions->version; v++)
+    {
+        seat_change_t* change = &versions->log[v % CHANGE_LOG_SIZE];
+        if (last_change[change->seat_id] != v)
+            continue;
+        if (skip != 0 && change->origin == skip)
+            continue;
+        if (count == max)
+        {
+            pthread_mutex_unlock(&versions->lock);
+            return -1;
         }
+        updates[count].id = change->seat_id;
+        updates[count].customer_id = change->customer_id;
+        updates[count].state = change->state;
+        count++;
+    }
+    pthread_mutex_unlock(&versions->lock);
+    return count;
+}
+
+/*
+ * Copy the latest change of every seat touched after `since` into
+ * updates. Returns how many there are, or -1 if `since` is no longer
+ * covered by the change log (or there are more than max) and the
+ * caller has to fall back to seats_snapshot.
+ */
+int seats_changes_since(unsigned long since, seat_update_t* updates, int max, unsigned long* version)
+{
+    return collect_changes(since, updates, max, version, 0);
+}
+
+/*
+ * Copy every seat into updates. The version is read first, so replaying
+ * the changes after it on top of the snapshot is always safe.
+ */
+int seats_snapshot(seat_update_t* updates, int max, unsigned long* version)
+{
+    seat_t* curr = seat_header;
+    int count = 0;
+
+    shared_mutex_lock(&versions->lock);
+    *version = versions->version;
+    pthread_mutex_unlock(&versions->lock);
+
+    while(curr != NULL && count < max)
+    {
+        shared_mutex_lock(&(curr->lock));
+        updates[count].id = curr->id;
+        updates[count].customer_id = curr->customer_id;
+        updates[count].state = curr->state;
         pthread_mutex_unlock(&(curr->lock));
+        count++;
         curr = curr->next;
     }
-    snprintf(buf, bufsize, "Seat not found\n\n");
-    
-    return;
+    return count;
+}
+
+/*
+ * Overwrite seats with states decided elsewhere (the primary). Goes
+ * through seat_changed like any local transition, so list_seats?since
+ * and /seat_events work on replicas too.
+ */
+void seats_apply(seat_update_t* updates, int count)
+{
+    int i;
+    for(i = 0; i < count; i++)
+    {
+        seat_t* seat;
+        if (updates[i].id < 0 || updates[i].id >= seat_total)
+            continue;
+        seat = seat_index[updates[i].id];
+        shared_mutex_lock(&(seat->lock));
+        if (seat->state != updates[i].state || seat->customer_id != updates[i].customer_id)
+        {
+            // the primary already enforced the hold cap
+            if (seat->state != AVAILABLE)
+                holds_remove(seat);
+            if (updates[i].state != AVAILABLE)
+                holds_add(seat, updates[i].customer_id, updates[i].state, 0);
+            else
+                seat->customer_id = updates[i].customer_id;
+            seat_changed(seat);
+        }
+        pthread_mutex_unlock(&(seat->lock));
+    }
+}
+
+unsigned long seats_wait_for_change(unsigned long since, int timeout_ms)
+{
+    struct timespec now, deadline;
+    unsigned long current;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (1)
+    {
+        // read before the version, a change in between fails the wait
+        uint32_t changes = __atomic_load_n(&versions->changes, __ATOMIC_SEQ_CST);
+        int left;
+
+        shared_mutex_lock(&versions->lock);
+        current = versions->version;
+        pthread_mutex_unlock(&versions->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (current > since || left <= 0)
+            return current;
+
+        __atomic_add_fetch(&versions->waiters, 1, __ATOMIC_SEQ_CST);
+        shared_wait(&versions->changes, changes, left);
+        __atomic_sub_fetch(&versions->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * With several workers on one seat map, changes made by the others
+ * still have to reach this process's /seat_events subscribers and
+ * waitlists. This thread follows the shared change log and replays them
+ * locally; seats released elsewhere go to this process's waiters.
+ */
+static void* watch_workers(void* arg)
+{
+    seat_update_t* updates = (seat_update_t*) malloc(seat_total * sizeof(seat_update_t));
+    unsigned long seen, current;
+    int count, i;
+
+    shared_mutex_lock(&versions->lock);
+    seen = versions->version;
+    pthread_mutex_unlock(&versions->lock);
+
+    while (updates != NULL)
+    {
+        if (seats_wait_for_change(seen, 1000) == seen)
+            continue;
+        // this worker already published and handed off its own changes
+        count = collect_changes(seen, updates, seat_total, &current, worker_pid);
+        if (count < 0)
+            count = seats_snapshot(updates, seat_total, &current);
+        seen = current;
+
+        for (i = 0; i < count; i++)
+        {
+            seat_t* seat = seat_index[updates[i].id];
+            seat_events_publish(updates[i].id, updates[i].state);
+            if (updates[i].state == OCCUPIED)
+                waitlist_drain(updates[i].id, "Seat unavailable\n\n");
+            if (updates[i].state != AVAILABLE)
+                continue;
+            uint64_t locked_at = lock_seat(seat);
+            if (seat->state == AVAILABLE)
+            {
+                hand_off(seat);
+                if (seat->state != AVAILABLE)
+                    seat_changed(seat);
+            }
+            unlock_seat(seat, locked_at);
+        }
+    }
+    return NULL;
+}
+
+int seats_watch_workers()
+{
+    pthread_t watcher;
+
+    worker_pid = getpid();
+    if (pthread_create(&watcher, NULL, watch_workers, NULL) != 0)
+        return -1;
+    pthread_detach(watcher);
+    return 0;
+}
+
+void seats_set_read_only(int on)
+{
+    read_only = on;
 }
 
 void load_seats(int number_of_seats)
 {
     seat_t* curr = NULL;
     int i;
+    versions = (seat_versions_t*) shared_calloc(1, sizeof(seat_versions_t));
+    shared_mutex_init(&versions->lock);
+    last_change = (unsigned long*) shared_calloc(number_of_seats, sizeof(unsigned long));
+    seat_index = (seat_t**) shared_calloc(number_of_seats, sizeof(seat_t*));
+    seat_total = number_of_seats;
+    holds_init(number_of_seats, hold_cap);
     for(i = 0; i < number_of_seats; i++)
     {   
-        seat_t* temp = (seat_t*) malloc(sizeof(seat_t));
+        seat_t* temp = (seat_t*) shared_calloc(1, sizeof(seat_t));
         temp->id = i;
         temp->customer_id = -1;
         temp->state = AVAILABLE;
         temp->next = NULL;          
-        pthread_mutex_init(&(temp->lock), NULL);    
+        temp->holder_prev = NULL;
+        temp->holder_next = NULL;
+        shared_mutex_init(&(temp->lock));    
+        seat_index[i] = temp;
         if (seat_header == NULL)
         {
             seat_header = temp;
@@ -161,8 +673,12 @@ void unload_seats()
     {
         seat_t* temp = curr;
         curr = curr->next;
-        free(temp);
+        shared_free(temp);
     }
+    shared_free(last_change);
+    shared_free(seat_index);
+    shared_free(versions);
+    holds_destroy();
 }
 
 char seat_state_to_char(seat_state_t state)
@@ -179,3 +695,16 @@ char seat_state_to_char(seat_state_t state)
 
     return '0';
 }
+
+seat_state_t char_to_seat_state(char c)
+{
+    switch(c)
+    {
+        case 'P':
+            return PENDING;
+        case 'O':
+            return OCCUPIED;
+    }
+
+    return AVAILABLE;
+}
@@ -16,15 +16,42 @@ typedef struct seat_struct
     seat_state_t state;
     struct seat_struct* next;
     pthread_mutex_t lock; 
+    struct seat_struct* holder_prev;    // other seats of customer_id, see holds.h
+    struct seat_struct* holder_next;
 } seat_t;
 
+/* A seat's replicated state, as shipped from a primary to its replicas */
+typedef struct seat_update_struct
+{
+    int id;
+    int customer_id;
+    seat_state_t state;
+} seat_update_t;
+
 
 void load_seats(int);
 void unload_seats();
 
+int list_seats_bufsize();
 void list_seats(char* buf, int bufsize);
+void list_seats_since(char* buf, int bufsize, unsigned long since);
+void list_seats_bitmap(char* buf, int bufsize);
 void view_seat(char* buf, int bufsize, int seat_num, int customer_num, int customer_priority);
+int wait_seat(char* buf, int bufsize, int seat_num, int customer_num, int customer_priority, int fd);
 void confirm_seat(char* buf, int bufsize, int seat_num, int customer_num, int customer_priority);
 void cancel(char* buf, int bufsize, int seat_num, int customer_num, int customer_priority);
+void my_seats(char* buf, int bufsize, int customer_num);
+void cancel_all(char* buf, int bufsize, int customer_num);
+void seats_set_hold_cap(int cap);
+
+int seats_changes_since(unsigned long since, seat_update_t* updates, int max, unsigned long* version);
+int seats_snapshot(seat_update_t* updates, int max, unsigned long* version);
+void seats_apply(seat_update_t* updates, int count);
+unsigned long seats_wait_for_change(unsigned long since, int timeout_ms);
+void seats_set_read_only(int on);
+int seats_watch_workers();
+
+char seat_state_to_char(seat_state_t);
+seat_state_t char_to_seat_state(char);
 
 #endif
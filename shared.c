@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shared.h"
+
+#define SHARED_ALIGN 64     // keeps locks of neighbouring allocations off one cache line
+
+static char* segment = NULL;
+static size_t segment_size = 0;
+static size_t segment_used = 0;
+
+
+int shared_init(size_t size)
+{
+    // untouched pages cost nothing, so the size can be generous
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    segment = (char*) mem;
+    segment_size = size;
+    segment_used = 0;
+    return 0;
+}
+
+bool shared_enabled()
+{
+    return segment != NULL;
+}
+
+void* shared_calloc(size_t count, size_t size)
+{
+    size_t bytes = (count * size + SHARED_ALIGN - 1) & ~((size_t) SHARED_ALIGN - 1);
+    void* ptr;
+
+    if (segment == NULL)
+        return calloc(count, size);
+    if (segment_used + bytes > segment_size)
+    {
+        fprintf(stderr, "Shared segment of %zu bytes is full\n", segment_size);
+        return NULL;
+    }
+    // anonymous mappings start zeroed and nothing is ever reused
+    ptr = segment + segment_used;
+    segment_used += bytes;
+    return ptr;
+}
+
+void shared_free(void* ptr)
+{
+    if (segment != NULL && (char*) ptr >= segment && (char*) ptr < segment + segment_size)
+        return;
+    free(ptr);
+}
+
+void shared_mutex_init(pthread_mutex_t* mutex)
+{
+    pthread_mutexattr_t attr;
+
+    if (segment == NULL)
+    {
+        pthread_mutex_init(mutex, NULL);
+        return;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void shared_mutex_lock(pthread_mutex_t* mutex)
+{
+    if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+    {
+        fprintf(stderr, "Recovered a lock held by a dead worker\n");
+        pthread_mutex_consistent(mutex);
+    }
+}
+
+void shared_wait(uint32_t* word, uint32_t expected, int timeout_ms)
+{
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+    // not FUTEX_PRIVATE_FLAG: the word may be in the shared segment
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+void shared_wake(uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,64 @@
+#ifndef _SHARED_H_
+#define _SHARED_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Memory shared by every worker process. The segment is mapped once,
+ * before the workers are forked, so it sits at the same address in all
+ * of them and pointers into it can be stored in it.
+ */
+
+/**
+ * @function shared_init
+ * @brief Maps the shared segment. Everything shared_calloc hands out
+ *        afterwards lives in it, and shared_mutex_init makes robust,
+ *        process-shared mutexes.
+ * @return 0 if all goes well, -1 otherwise
+ */
+int shared_init(size_t size);
+
+/**
+ * @function shared_enabled
+ * @brief Whether shared_init was called, i.e. state is shared by
+ *        several processes.
+ */
+bool shared_enabled();
+
+/**
+ * @function shared_calloc / shared_free
+ * @brief Zeroed memory from the segment, or from calloc without one.
+ *        Segment memory is never given back; shared_free ignores it.
+ *        Only call shared_calloc before forking the workers.
+ */
+void* shared_calloc(size_t count, size_t size);
+void shared_free(void* ptr);
+
+/**
+ * @function shared_mutex_init
+ * @brief Initialise a lock that may live in the segment.
+ */
+void shared_mutex_init(pthread_mutex_t* mutex);
+
+/**
+ * @function shared_mutex_lock
+ * @brief pthread_mutex_lock that takes over a lock whose owner died
+ *        holding it (a crashed worker) instead of failing. Whatever
+ *        the owner was doing stays as it left it.
+ */
+void shared_mutex_lock(pthread_mutex_t* mutex);
+
+/**
+ * @function shared_wait / shared_wake
+ * @brief Sleep until *word is no longer expected (or timeout_ms passes),
+ *        and wake every sleeper after changing *word. Stand-ins for a
+ *        condition variable: a process-shared pthread_cond_t can hang
+ *        every later broadcast if a waiting worker is killed.
+ */
+void shared_wait(uint32_t* word, uint32_t expected, int timeout_ms);
+void shared_wake(uint32_t* word);
+
+#endif
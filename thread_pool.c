@@ -27,8 +27,11 @@ struct threadpool_t {
   pthread_cond_t notify;
   pthread_t *threads; //array of threads
   threadpool_task_t *queue; //LL of threadpool_tasks 
+  threadpool_task_t *tasks; //preallocated task nodes, queue_size + the shutdown task
+  threadpool_task_t *free_tasks; //LL of unused task nodes
   int thread_count;
   int task_queue_size_limit;
+  int queue_count; //tasks currently in the queue
 };
 
 /**
@@ -51,6 +54,18 @@ printf("Initalizing thread pool \n");
 threadpool_t* thread_pool = (threadpool_t*) malloc (sizeof(threadpool_t));
 thread_pool->thread_count=thread_count;
 thread_pool->task_queue_size_limit = queue_size;
+thread_pool->queue=NULL; /*task queue is initally empty*/
+thread_pool->queue_count=0;
+
+/*task nodes are allocated once here so adding a task never mallocs*/
+thread_pool->tasks = (threadpool_task_t*) malloc (sizeof(threadpool_task_t)*(queue_size+1));
+thread_pool->free_tasks = NULL;
+int t;
+for (t=0; t<queue_size+1; t++)
+{
+	thread_pool->tasks[t].next = thread_pool->free_tasks;
+	thread_pool->free_tasks = &thread_pool->tasks[t];
+}
 
 /*create mutex*/
 pthread_mutex_t lock;
@@ -83,8 +98,6 @@ for (i=0; i<thread_count; i++)
 } 
 thread_pool->threads = threads;
 
-thread_pool->queue=NULL; /*task queue is initally empty*/
-
 return thread_pool;
 }
 
@@ -107,11 +120,24 @@ if (err)
 return -1;
 }
     /*set the lock, now the queue is locked from the other threads*/
+
+    /*refuse work beyond the queue limit, the shutdown task always fits*/
+    if (function != NULL && pool->queue_count >= pool->task_queue_size_limit)
+    {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
     
     /* Add task to queue */
    
-    /*create a new task*/
-    threadpool_task_t* new_task = (threadpool_task_t*) malloc (sizeof(threadpool_task_t));
+    /*take a task node from the free list*/
+    threadpool_task_t* new_task = pool->free_tasks;
+    if (new_task == NULL)
+    {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    pool->free_tasks = new_task->next;
     new_task->function=function;
     new_task->argument=argument;
     new_task->next=NULL;
@@ -131,6 +157,7 @@ return -1;
    
      curr->next = new_task;
      } 
+   pool->queue_count++;
 
    /*done updating the queue, notify the sleeping threads and unlock mutex*/
 
@@ -157,6 +184,17 @@ return -1;
 
 
 
+/*
+ * Number of queued tasks, read without the lock: callers use it as a
+ * load signal and can live with a slightly stale value.
+ */
+int threadpool_queue_depth(threadpool_t *pool)
+{
+    return __atomic_load_n(&pool->queue_count, __ATOMIC_RELAXED);
+}
+
+
+
 /*
  * Destroy the threadpool, free all memory, destroy treads, etc
  *
@@ -174,7 +212,7 @@ int threadpool_destroy(threadpool_t *pool)
 	{pthread_join(pool->threads[i],NULL);}  		
 
     /* Only if everything went well do we deallocate the pool */
-   free ((void*) pool->queue);
+   free ((void*) pool->tasks);
    free ((void*) pool->threads);
    free ((void*) pool);  
 
@@ -208,9 +246,14 @@ static void *thread_do_work(void *threadpool)
 	}
         /* Wait on condition variable, check for spurious wakeups.
            When returning from pthread_cond_wait(), do some task. */
-       err = pthread_cond_wait(notify, lock);
-       if (err)
-       {printf("pthread_cond_wait error \n");}
+       /* Only sleep while there is nothing to do, otherwise tasks added
+          while every worker was busy would wait for the next broadcast. */
+       while (pool->queue == NULL)
+       {
+         err = pthread_cond_wait(notify, lock);
+         if (err)
+         {printf("pthread_cond_wait error \n");}
+       }
         /*block on notify. Atomically(?) release lock- what does this mean? */
         
         /* Grab our task from the queue */
@@ -232,6 +275,15 @@ static void *thread_do_work(void *threadpool)
 
        /*delete task from LL*/
         pool->queue=pool->queue->next;   
+        pool->queue_count--;
+
+        /* Take the task and give the node back while we hold the lock */
+         void (*function) (void*);
+         void *argument;
+         function = curr_task->function;
+         argument = curr_task->argument;
+         curr_task->next = pool->free_tasks;
+         pool->free_tasks = curr_task;
         
         /*Unlock mutex for others*/
 	err = pthread_mutex_unlock(lock);
@@ -239,13 +291,6 @@ static void *thread_do_work(void *threadpool)
         {printf("pthread_mutex_unlock error \n");}
 
         /* Start the task */
-         void (*function) (void*);
-         void *argument;
-         function = curr_task->function;
-         argument = curr_task->argument;
-        printf("About to free curr_task. \n"); 
-         free ((void*) curr_task);    
-	printf("Freed curr_task \n");
          function(argument);
         printf("Called function. \n");
     }
@@ -19,9 +19,18 @@ threadpool_t *threadpool_create(int thread_count, int queue_size);
  * @param function Pointer to the function that will perform the task.
  * @param argument Argument to be passed to the function.
  * @return 0 if all goes well, negative values in case of error
+ *         (including a full queue)
  */
 int threadpool_add_task(threadpool_t *pool, void (*routine)(void *), void *arg);
 
+/**
+ * @function threadpool_queue_depth
+ * @brief Number of tasks waiting for a worker.
+ * @param pool  Threadpool to inspect.
+ * @return the current queue length
+ */
+int threadpool_queue_depth(threadpool_t *pool);
+
 /**
  * @function threadpool_destroy
  * @brief Stops and destroys a thread pool.
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096    // events kept per thread, must be a power of two
+
+/**
+ *  @struct trace_event_t
+ *  @brief one span; phase is 'X' (complete), 'b' or 'e' (async)
+ */
+typedef struct trace_event_struct
+{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint32_t request;
+    char phase;
+} trace_event_t;
+
+/**
+ *  @struct trace_ring_t
+ *  @brief events of one thread; only that thread writes, head counts
+ *         every event ever recorded
+ */
+typedef struct trace_ring_struct
+{
+    int tid;
+    uint64_t head;
+    trace_event_t events[TRACE_RING_SIZE];
+    struct trace_ring_struct* next;
+} trace_ring_t;
+
+static int sample_every = 0;
+static uint32_t request_counter = 0;
+static double ticks_per_us = 1000.0;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t* rings = NULL;
+
+static __thread trace_ring_t* local_ring = NULL;
+static __thread uint32_t current_request = 0;
+
+static void* dump_on_signal(void*);
+
+
+uint64_t trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_init(int every)
+{
+    sigset_t mask;
+    pthread_t dumper;
+
+    sample_every = every > 0 ? every : 0;
+    if (sample_every == 0)
+        return;
+
+    // how many ticks make a microsecond; 10ms is plenty for a trace
+    struct timespec pause = { 0, 10000000 };
+    uint64_t ns = monotonic_ns(), ticks = trace_now();
+    nanosleep(&pause, NULL);
+    ns = monotonic_ns() - ns;
+    ticks = trace_now() - ticks;
+    if (ns > 0 && ticks > 0)
+        ticks_per_us = (double) ticks * 1000.0 / ns;
+
+    // every thread started after this inherits the blocked SIGUSR2
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    if (pthread_create(&dumper, NULL, dump_on_signal, NULL) == 0)
+        pthread_detach(dumper);
+}
+
+uint32_t trace_sample()
+{
+    if (sample_every == 0)
+        return 0;
+    uint32_t n = __atomic_add_fetch(&request_counter, 1, __ATOMIC_RELAXED);
+    if (n % sample_every != 0)
+        return 0;
+    // 0 means "not traced", keep it out of the id space
+    return n == 0 ? 1 : n;
+}
+
+void trace_set_request(uint32_t request_id)
+{
+    current_request = request_id;
+}
+
+static void record(const char* name, char phase, uint32_t request, uint64_t start, uint64_t end)
+{
+    trace_ring_t* ring = local_ring;
+
+    if (ring == NULL)
+    {
+        // once per thread; mmap keeps the ring out of the malloc heap
+        ring = (trace_ring_t*) mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED)
+            return;
+        ring->tid = (int) syscall(SYS_gettid);
+        ring->head = 0;
+        pthread_mutex_lock(&rings_lock);
+        ring->next = rings;
+        rings = ring;
+        pthread_mutex_unlock(&rings_lock);
+        local_ring = ring;
+    }
+
+    trace_event_t* ev = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+    ev->name = name;
+    ev->phase = phase;
+    ev->request = request;
+    ev->start = start;
+    ev->end = end;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_span(const char* name, uint64_t start)
+{
+    if (current_request == 0)
+        return;
+    record(name, 'X', current_request, start, trace_now());
+}
+
+void trace_async_begin(const char* name, uint32_t request_id)
+{
+    if (request_id == 0)
+        return;
+    uint64_t now = trace_now();
+    record(name, 'b', request_id, now, now);
+}
+
+void trace_async_end(const char* name, uint32_t request_id)
+{
+    if (request_id == 0)
+        return;
+    uint64_t now = trace_now();
+    record(name, 'e', request_id, now, now);
+}
+
+/*
+ * Rings are read while their threads keep writing; an event overwritten
+ * mid-dump may come out garbled, which a diagnostic dump can live with.
+ */
+static void write_json(FILE* out)
+{
+    trace_ring_t* ring;
+    uint64_t base = 0;
+    int first = 1;
+
+    pthread_mutex_lock(&rings_lock);
+    // timestamps are relative to the oldest event still buffered
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t oldest = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        if (head > oldest)
+        {
+            uint64_t start = ring->events[oldest & (TRACE_RING_SIZE - 1)].start;
+            if (base == 0 || start < base)
+                base = start;
+        }
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (; i < head; i++)
+        {
+            trace_event_t ev = ring->events[i & (TRACE_RING_SIZE - 1)];
+            double ts = (ev.start >= base ? ev.start - base : 0) / ticks_per_us;
+
+            fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+                    first ? "" : ",", ev.name, ev.phase, (int) getpid(), ring->tid, ts);
+            if (ev.phase == 'X')
+                fprintf(out, ",\"dur\":%.3f", (ev.end - ev.start) / ticks_per_us);
+            else
+                fprintf(out, ",\"cat\":\"request\",\"id\":%u", ev.request);
+            fprintf(out, ",\"args\":{\"request\":%u}}", ev.request);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    pthread_mutex_unlock(&rings_lock);
+}
+
+int trace_dump_fd()
+{
+    FILE* out = tmpfile();
+    int fd;
+
+    if (out == NULL)
+        return -1;
+    write_json(out);
+    fflush(out);
+    fd = dup(fileno(out));
+    fclose(out);
+    if (fd >= 0)
+        lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static void* dump_on_signal(void* arg)
+{
+    sigset_t mask;
+    int sig;
+    char path[64];
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    while (sigwait(&mask, &sig) == 0)
+    {
+        FILE* out;
+        snprintf(path, sizeof(path), "trace-%d.json", (int) getpid());
+        if ((out = fopen(path, "w")) == NULL)
+        {
+            perror(path);
+            continue;
+        }
+        write_json(out);
+        fclose(out);
+        printf("Wrote %s\n", path);
+    }
+    return NULL;
+}
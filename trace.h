@@ -0,0 +1,58 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/**
+ * @function trace_init
+ * @brief Enables request tracing. Spans of sampled requests are kept in
+ *        per-thread ring buffers, timestamped with the TSC. Must be
+ *        called before any other thread is started: it also starts the
+ *        thread that writes trace-<pid>.json on SIGUSR2.
+ * @param sample_every Trace one request in sample_every, 0 disables.
+ */
+void trace_init(int sample_every);
+
+/**
+ * @function trace_sample
+ * @brief Decides whether a new request is traced.
+ * @return a request id, or 0 if the request is not sampled
+ */
+uint32_t trace_sample();
+
+/**
+ * @function trace_set_request
+ * @brief Attributes the calling thread's spans to request_id from now
+ *        on (0 stops recording).
+ */
+void trace_set_request(uint32_t request_id);
+
+/**
+ * @function trace_now
+ * @brief Current timestamp in trace ticks; cheap enough for every span.
+ */
+uint64_t trace_now();
+
+/**
+ * @function trace_span
+ * @brief Records a span from start until now for the current request.
+ *        name must be a string literal (only the pointer is kept).
+ */
+void trace_span(const char* name, uint64_t start);
+
+/**
+ * @function trace_async_begin / trace_async_end
+ * @brief Records a span that starts and ends on different threads,
+ *        e.g. the time a request waits in the thread pool queue.
+ */
+void trace_async_begin(const char* name, uint32_t request_id);
+void trace_async_end(const char* name, uint32_t request_id);
+
+/**
+ * @function trace_dump_fd
+ * @brief Writes every buffered span as Chrome/Perfetto trace JSON.
+ * @return an fd positioned at the start of the JSON, -1 on error
+ */
+int trace_dump_fd();
+
+#endif
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "uring_server.h"
+#include "seat_events.h"
+#include "admission.h"
+#include "util.h"
+#include "trace.h"
+#include "seats.h"
+
+#define RING_ENTRIES 1024
+#define MAX_CONNS 4096
+#define RECV_BUFS 1024          // must be a power of two
+#define RECV_BUF_SIZE 2048
+#define RECV_GROUP 1
+#define FILE_BUFS 64
+#define FILE_BUF_SIZE 16384
+#define REQUEST_MAX 4096
+#define ARENA_SIZE 4096
+#define LARGE_BODIES 64         // list_seats-sized bodies served at once without malloc
+
+#define LISTEN_SLOT 0           // index of the listen socket in the registered files
+
+enum
+{
+    OP_ACCEPT,
+    OP_RECV,
+    OP_SEND,
+    OP_READ,
+    OP_CLOSE
+};
+
+/**
+ *  @struct uring_conn_t
+ *  @brief state of one connection driven by the ring
+ *
+ *  @var request  Bytes received so far, NUL terminated.
+ *  @var arena    Parsed request and response body; created with the
+ *                slot and trimmed back to its first chunk when the
+ *                connection closes, so idle slots hold ARENA_SIZE bytes.
+ *  @var seg      Header and body still to be sent, as linked sends.
+ *  @var sent     Bytes of seg already sent.
+ *  @var inflight Sends submitted and not completed yet.
+ *  @var file_buf Registered buffer used to stream resp.file_fd, -1 if
+ *                file_scratch (from the arena) is used instead.
+ */
+typedef struct uring_conn_struct
+{
+    int fd;
+    char request[REQUEST_MAX+1];
+    int request_len;
+    arena_t* arena;
+    http_response_t resp;
+    struct
+    {
+        char* data;
+        int len;
+    } seg[2];
+    int nseg;
+    int sent;
+    int inflight;
+    int failed;
+    int file_buf;
+    char* file_scratch;
+    off_t file_off;
+    uint32_t request_id;
+    struct uring_conn_struct* next_free;
+} uring_conn_t;
+
+static struct
+{
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+} ring;
+
+static struct io_uring_buf_ring* recv_ring;
+static char* recv_bufs;
+static unsigned short recv_tail;
+
+static char* file_bufs;
+static int free_file_bufs[FILE_BUFS];
+static int num_free_file_bufs;
+
+static uring_conn_t* conns;
+static uring_conn_t* free_conns;
+static int accepting;
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int ring_setup()
+{
+    struct io_uring_params p;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+
+    memset(&p, 0, sizeof(p));
+    // one thread submits and reaps, let the kernel skip cross-thread wakeups
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    ring.fd = sys_io_uring_setup(RING_ENTRIES, &p);
+    if (ring.fd < 0 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof(p));
+        ring.fd = sys_io_uring_setup(RING_ENTRIES, &p);
+    }
+    if (ring.fd < 0)
+        return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+    {
+        close(ring.fd);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > sq_size)
+        sq_size = cq_size;
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        close(ring.fd);
+        return -1;
+    }
+    cq_ptr = sq_ptr;
+
+    ring.sq_head = (unsigned*) ((char*) sq_ptr + p.sq_off.head);
+    ring.sq_tail = (unsigned*) ((char*) sq_ptr + p.sq_off.tail);
+    ring.sq_mask = (unsigned*) ((char*) sq_ptr + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned*) ((char*) sq_ptr + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.to_submit = 0;
+
+    ring.sqes = (struct io_uring_sqe*) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+    {
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.cq_head = (unsigned*) ((char*) cq_ptr + p.cq_off.head);
+    ring.cq_tail = (unsigned*) ((char*) cq_ptr + p.cq_off.tail);
+    ring.cq_mask = (unsigned*) ((char*) cq_ptr + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*) ((char*) cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+static int ring_submit(unsigned min_complete)
+{
+    int ret;
+
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+    do
+    {
+        ret = sys_io_uring_enter(ring.fd, ring.to_submit, min_complete,
+                min_complete ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0)
+        ring.to_submit -= (unsigned) ret < ring.to_submit ? (unsigned) ret : ring.to_submit;
+    return ret;
+}
+
+/*
+ * Next free submission entry, zeroed. Entries are only handed to the
+ * kernel in ring_submit, so everything queued while handling one batch
+ * of completions goes out with a single io_uring_enter.
+ */
+static struct io_uring_sqe* get_sqe()
+{
+    struct io_uring_sqe* sqe;
+    unsigned index;
+
+    while (ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries)
+        ring_submit(0);
+
+    index = ring.sq_local_tail & *ring.sq_mask;
+    sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    ring.sq_local_tail++;
+    ring.to_submit++;
+    return sqe;
+}
+
+static uint64_t pack(int op, uring_conn_t* c)
+{
+    return ((uint64_t) op << 32) | (uint32_t) (c == NULL ? 0 : c - conns);
+}
+
+static void recycle_recv_buf(int bid)
+{
+    struct io_uring_buf* buf = &recv_ring->bufs[recv_tail & (RECV_BUFS - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (recv_bufs + (size_t) bid * RECV_BUF_SIZE);
+    buf->len = RECV_BUF_SIZE;
+    buf->bid = bid;
+    recv_tail++;
+    __atomic_store_n(&recv_ring->tail, recv_tail, __ATOMIC_RELEASE);
+}
+
+static int register_buffers(int listenfd)
+{
+    struct io_uring_buf_reg reg;
+    struct iovec iov[FILE_BUFS];
+    int i;
+
+    if (sys_io_uring_register(ring.fd, IORING_REGISTER_FILES, &listenfd, 1) < 0)
+        return -1;
+
+    // recv buffers are picked by the kernel from this ring as data arrives
+    recv_ring = (struct io_uring_buf_ring*) mmap(NULL, RECV_BUFS * sizeof(struct io_uring_buf),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    recv_bufs = (char*) malloc((size_t) RECV_BUFS * RECV_BUF_SIZE);
+    if (recv_ring == MAP_FAILED || recv_bufs == NULL)
+        return -1;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) recv_ring;
+    reg.ring_entries = RECV_BUFS;
+    reg.bgid = RECV_GROUP;
+    if (sys_io_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+    recv_tail = 0;
+    for (i = 0; i < RECV_BUFS; i++)
+        recycle_recv_buf(i);
+
+    // static files are read into pinned buffers
+    file_bufs = (char*) malloc((size_t) FILE_BUFS * FILE_BUF_SIZE);
+    if (file_bufs == NULL)
+        return -1;
+    for (i = 0; i < FILE_BUFS; i++)
+    {
+        iov[i].iov_base = file_bufs + (size_t) i * FILE_BUF_SIZE;
+        iov[i].iov_len = FILE_BUF_SIZE;
+        free_file_bufs[i] = i;
+    }
+    num_free_file_bufs = FILE_BUFS;
+    if (sys_io_uring_register(ring.fd, IORING_REGISTER_BUFFERS, iov, FILE_BUFS) < 0)
+        return -1;
+    return 0;
+}
+
+static void arm_accept()
+{
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = LISTEN_SLOT;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = pack(OP_ACCEPT, NULL);
+}
+
+static void arm_recv(uring_conn_t* c)
+{
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->len = RECV_BUF_SIZE;
+    sqe->user_data = pack(OP_RECV, c);
+}
+
+static void close_conn(uring_conn_t* c)
+{
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = c->fd;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = pack(OP_CLOSE, c);
+
+    if (c->resp.file_fd >= 0)
+        close(c->resp.file_fd);
+    if (c->file_buf >= 0)
+        free_file_bufs[num_free_file_bufs++] = c->file_buf;
+    arena_trim(c->arena);
+    trace_async_end("connection", c->request_id);
+    c->fd = -1;
+    c->next_free = free_conns;
+    free_conns = c;
+}
+
+/*
+ * Queue whatever part of seg[] has not been sent yet as a chain of
+ * linked sends. A short send breaks the chain; the rest is cancelled
+ * and queued again once every link has completed.
+ */
+static void queue_sends(uring_conn_t* c)
+{
+    struct io_uring_sqe* prev = NULL;
+    int skip = c->sent;
+    int i;
+
+    c->failed = 0;
+    for (i = 0; i < c->nseg; i++)
+    {
+        struct io_uring_sqe* sqe;
+        if (skip >= c->seg[i].len)
+        {
+            skip -= c->seg[i].len;
+            continue;
+        }
+        if (prev != NULL)
+            prev->flags |= IOSQE_IO_LINK;
+        sqe = get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (c->seg[i].data + skip);
+        sqe->len = c->seg[i].len - skip;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = pack(OP_SEND, c);
+        c->inflight++;
+        prev = sqe;
+        skip = 0;
+    }
+}
+
+static void queue_file_read(uring_conn_t* c)
+{
+    struct io_uring_sqe* sqe;
+
+    if (c->file_buf < 0 && num_free_file_bufs > 0)
+        c->file_buf = free_file_bufs[--num_free_file_bufs];
+
+    sqe = get_sqe();
+    sqe->fd = c->resp.file_fd;
+    sqe->off = c->file_off;
+    if (c->file_buf >= 0)
+    {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t) (uintptr_t) (file_bufs + (size_t) c->file_buf * FILE_BUF_SIZE);
+        sqe->len = FILE_BUF_SIZE;
+        sqe->buf_index = c->file_buf;
+    }
+    else
+    {
+        // every pinned buffer is in use, read through the arena
+        if (c->file_scratch == NULL)
+            c->file_scratch = (char*) arena_alloc(c->arena, FILE_BUF_SIZE);
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = (uint64_t) (uintptr_t) c->file_scratch;
+        sqe->len = FILE_BUF_SIZE;
+    }
+    sqe->user_data = pack(OP_READ, c);
+}
+
+static int request_complete(uring_conn_t* c)
+{
+    return c->request_len >= REQUEST_MAX
+        || strstr(c->request, "\r\n\r\n") != NULL
+        || strstr(c->request, "\n\n") != NULL;
+}
+
+static void start_response(uring_conn_t* c)
+{
+    uint64_t started_at = trace_now();
+    trace_set_request(c->request_id);
+    handle_request(c->request, c->fd, c->arena, &c->resp);
+    trace_span("handle", started_at);
+    trace_set_request(0);
+
+    if (c->resp.subscribe || c->resp.parked)
+    {
+        // the publisher or a waitlist owns the socket now, just give up the slot
+        if (c->resp.subscribe)
+            seat_events_subscribe(c->fd);
+        arena_trim(c->arena);
+        trace_async_end("connection", c->request_id);
+        c->fd = -1;
+        c->next_free = free_conns;
+        free_conns = c;
+        return;
+    }
+
+    c->seg[0].data = c->resp.header;
+    c->seg[0].len = strlen(c->resp.header);
+    c->seg[1].data = c->resp.body;
+    c->seg[1].len = c->resp.body_len;
+    c->nseg = c->resp.body_len > 0 ? 2 : 1;
+    c->sent = 0;
+    queue_sends(c);
+}
+
+static void on_accept(int res, unsigned flags)
+{
+    uring_conn_t* c;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (!(flags & IORING_CQE_F_MORE))
+        arm_accept();
+    if (res < 0)
+        return;
+    accepting = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    getpeername(res, (struct sockaddr*) &addr, &addr_len);
+    // there is no task queue here; the connection table is the limit
+    admission_t verdict = admission_check(addr.sin_addr.s_addr, 0);
+    if (verdict == ADMIT && free_conns == NULL)
+        verdict = SHED;
+    if (verdict != ADMIT)
+    {
+        admission_reject(res, verdict);
+        return;
+    }
+
+    c = free_conns;
+    free_conns = c->next_free;
+    c->fd = res;
+    c->request_len = 0;
+    c->request[0] = '\0';
+    c->resp.file_fd = -1;
+    c->file_buf = -1;
+    c->file_scratch = NULL;
+    c->file_off = 0;
+    c->inflight = 0;
+    c->request_id = trace_sample();
+    trace_async_begin("connection", c->request_id);
+    arm_recv(c);
+}
+
+static void on_recv(uring_conn_t* c, int res, unsigned flags)
+{
+    if (res == -ENOBUFS)
+    {
+        // every recv buffer is in flight; they come back as we parse
+        arm_recv(c);
+        return;
+    }
+    if (res <= 0)
+    {
+        close_conn(c);
+        return;
+    }
+
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    int len = res;
+    if (len > REQUEST_MAX - c->request_len)
+        len = REQUEST_MAX - c->request_len;
+    memcpy(c->request + c->request_len, recv_bufs + (size_t) bid * RECV_BUF_SIZE, len);
+    c->request_len += len;
+    c->request[c->request_len] = '\0';
+    recycle_recv_buf(bid);
+
+    if (request_complete(c))
+        start_response(c);
+    else
+        arm_recv(c);
+}
+
+static void on_send(uring_conn_t* c, int res)
+{
+    c->inflight--;
+    if (res > 0)
+        c->sent += res;
+    else if (res != -ECANCELED)
+        c->failed = 1;
+    if (c->inflight > 0)
+        return;
+
+    int total = 0, i;
+    for (i = 0; i < c->nseg; i++)
+        total += c->seg[i].len;
+
+    if (c->failed)
+        close_conn(c);
+    else if (c->sent < total)
+        queue_sends(c);
+    else if (c->resp.file_fd >= 0)
+        queue_file_read(c);
+    else
+        close_conn(c);
+}
+
+static void on_read(uring_conn_t* c, int res)
+{
+    if (res <= 0)
+    {
+        close_conn(c);
+        return;
+    }
+    c->file_off += res;
+    c->seg[0].data = c->file_buf >= 0 ? file_bufs + (size_t) c->file_buf * FILE_BUF_SIZE : c->file_scratch;
+    c->seg[0].len = res;
+    c->nseg = 1;
+    c->sent = 0;
+    queue_sends(c);
+}
+
+int uring_server_run(int listenfd)
+{
+    int i;
+
+    if (ring_setup() != 0)
+    {
+        perror("io_uring setup");
+        return -1;
+    }
+    if (register_buffers(listenfd) != 0)
+    {
+        perror("io_uring register");
+        close(ring.fd);
+        return -1;
+    }
+
+    conns = (uring_conn_t*) calloc(MAX_CONNS, sizeof(uring_conn_t));
+    if (conns == NULL)
+    {
+        close(ring.fd);
+        return -1;
+    }
+    free_conns = NULL;
+    for (i = MAX_CONNS - 1; i >= 0; i--)
+    {
+        // every slot gets its arena now, so accepting never allocates
+        if ((conns[i].arena = arena_create(ARENA_SIZE)) == NULL)
+        {
+            fprintf(stderr, "io_uring: no memory for connection arenas\n");
+            while (++i < MAX_CONNS)
+                arena_destroy(conns[i].arena);
+            free(conns);
+            close(ring.fd);
+            return -1;
+        }
+        conns[i].fd = -1;
+        conns[i].next_free = free_conns;
+        free_conns = &conns[i];
+    }
+    // a map body outgrows the first chunk and goes back to the spares on close
+    arena_reserve(list_seats_bufsize(), LARGE_BODIES);
+
+    printf("Serving with io_uring\n");
+    accepting = 0;
+    arm_accept();
+
+    while (1)
+    {
+        unsigned head, tail;
+
+        if (ring_submit(1) < 0 && errno != EBUSY)
+        {
+            perror("io_uring_enter");
+            continue;
+        }
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            int op = (int) (cqe->user_data >> 32);
+            uring_conn_t* c = &conns[(uint32_t) cqe->user_data];
+
+            switch (op)
+            {
+                case OP_ACCEPT:
+                    // kernels without multishot accept reject it outright
+                    if (cqe->res == -EINVAL && !accepting)
+                    {
+                        fprintf(stderr, "io_uring: multishot accept not supported\n");
+                        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+                        close(ring.fd);
+                        return -1;
+                    }
+                    on_accept(cqe->res, cqe->flags);
+                    break;
+                case OP_RECV:
+                    on_recv(c, cqe->res, cqe->flags);
+                    break;
+                case OP_SEND:
+                    on_send(c, cqe->res);
+                    break;
+                case OP_READ:
+                    on_read(c, cqe->res);
+                    break;
+                case OP_CLOSE:
+                    break;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef _URING_SERVER_H_
+#define _URING_SERVER_H_
+
+/**
+ * @function uring_server_run
+ * @brief Serves connections on listenfd from the calling thread using
+ *        io_uring: multishot accept on a registered listen socket, recv
+ *        into a provided buffer ring, linked header/body sends and
+ *        static files read through registered buffers.
+ * @param listenfd Bound, listening socket.
+ * @return -1 if io_uring (or a feature it needs) is not available, in
+ *         which case the caller should fall back to the thread pool.
+ *         Does not return otherwise.
+ */
+int uring_server_run(int listenfd);
+
+#endif
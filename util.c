@@ -6,27 +6,46 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <stdint.h>
 #include "util.h"
 
 #include "seats.h"
+#include "seat_events.h"
+#include "admission.h"
+#include "replication.h"
+#include "waitlist.h"
+#include "assets.h"
+#include "trace.h"
 
 #define BUFSIZE 1024
+#define MAX_LINE 8192
 
 int writenbytes(int,char *,int);
 int readnbytes(int,char *,int);
 int get_line(int, char*,int);
 
 int parse_int_arg(char* filename, char* arg);
+bool has_arg(char* filename, char* arg);
 
 
-void handle_connection_wrapper(void* connfd_ptr)
+void handle_connection_wrapper(void* connfd_arg)
 {
 
-handle_connection((int*) connfd_ptr);
+uint64_t task = (uintptr_t) connfd_arg;
+int connfd = (int) (uint32_t) task;
+uint32_t request_id = (uint32_t) (task >> 32);
+
+trace_set_request(request_id);
+trace_async_end("queued", request_id);
+handle_connection(&connfd);
+trace_set_request(0);
+// everything the request allocated goes at once
+arena_reset(thread_arena());
 
 }
 
@@ -35,15 +54,116 @@ void handle_connection(int* connfd_ptr)
     printf("In handle connection \n");
     int connfd = *(connfd_ptr);
 
-    int fd;
-    char buf[BUFSIZE+1];
-    char instr[20];
-    char file[100];
-    char type[20];
+    arena_t* arena = thread_arena();
+    char* request = (char*) arena_alloc(arena, MAX_LINE);
+    char* buf = (char*) arena_alloc(arena, BUFSIZE);
+    http_response_t resp;
 
-    int i=0;
-    int j=0;
+    if (request == NULL || buf == NULL)
+    {
+        close(connfd);
+        return;
+    }
+
+    // first read loop -- get request and headers
+    printf("connfd = %d \n", connfd);  
+    uint64_t started_at = trace_now();
+    int length = get_line(connfd, request, MAX_LINE);
+    int n;
+
+    while ((n = get_line(connfd, buf, BUFSIZE)) > 0)
+    {
+        // keep the headers after the request line, as far as they fit
+        if (length + n + 1 < MAX_LINE)
+        {
+            request[length++] = '\n';
+            memcpy(request + length, buf, n + 1);
+            length += n;
+        }
+    }
+    trace_span("read", started_at);
+
+    handle_request(request, connfd, arena, &resp);
+
+    if (resp.subscribe)
+    {
+        // the publisher owns the connection from here on
+        seat_events_subscribe(connfd);
+        return;
+    }
+    if (resp.parked)
+        return;
+
+    // send headers
+    started_at = trace_now();
+    writenbytes(connfd, resp.header, strlen(resp.header));
+    // send data
+    if (resp.body_len > 0)
+        writenbytes(connfd, resp.body, resp.body_len);
+    if (resp.file_fd >= 0)
+    {
+        // send file
+        int ret;
+        while ( (ret = read(resp.file_fd, buf, BUFSIZE)) > 0) {
+            writenbytes(connfd, buf, ret);
+        }  
+        // close file and free space
+        close(resp.file_fd);
+    }
+    close(connfd);
+    trace_span("write", started_at);
+}
 
+/*
+ * Value of header `name` among the lines after the request line, copied
+ * into the arena, or NULL if the request does not have it.
+ */
+static char* find_header(arena_t* arena, char* request, const char* name)
+{
+    size_t len = strlen(name);
+    char* line = strchr(request, '\n');
+    while (line != NULL)
+    {
+        line++;
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':')
+            return arena_strndup(arena, line + len + 1, strcspn(line + len + 1, "\r\n"));
+        line = strchr(line, '\n');
+    }
+    return NULL;
+}
+
+/* Whether the client of connfd is on this host */
+static bool from_loopback(int connfd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (getpeername(connfd, (struct sockaddr*) &addr, &len) != 0)
+        return false;
+    if (addr.ss_family == AF_INET)
+        return (ntohl(((struct sockaddr_in*) &addr)->sin_addr.s_addr) >> 24) == 127;
+    if (addr.ss_family == AF_INET6)
+        return IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6*) &addr)->sin6_addr);
+    return false;
+}
+
+/*
+ * Copy the next space separated token of line starting at *pos into
+ * the arena and move *pos past it.
+ */
+static char* next_token(arena_t* arena, char* line, int* pos)
+{
+    int start = *pos;
+    while (line[*pos] != '\0' && !isspace(line[*pos]))
+        (*pos)++;
+    char* token = arena_strndup(arena, line + start, *pos - start);
+    if (line[*pos] != '\0')
+        (*pos)++;
+    return token;
+}
+
+void handle_request(char* request, int connfd, arena_t* arena, http_response_t* resp)
+{
     char *ok_response = "HTTP/1.0 200 OK\r\n"\
                            "Content-type: text/html\r\n\r\n";
 
@@ -57,140 +177,165 @@ void handle_connection(int* connfd_ptr)
                               "Content-type: text/html\r\n\r\n"\
                               "<html><body><h2>BAD REQUEST</h2>"\
                               "</body></html>\n";
-                              
 
-    // first read loop -- get request and headers
+    char *forbidden = "HTTP/1.0 403 FORBIDDEN\r\n"\
+                         "Content-type: text/html\r\n\r\n"\
+                         "<html><body><h2>FORBIDDEN</h2>"\
+                         "</body></html>\n";
+
+    char *json_response = "HTTP/1.0 200 OK\r\n"\
+                           "Content-type: application/json\r\n\r\n";
+
+    uint64_t started_at = trace_now();
+    resp->header = ok_response;
+    resp->body = NULL;
+    resp->body_len = 0;
+    resp->file_fd = -1;
+    resp->subscribe = false;
+    resp->parked = false;
 
     // parse request to get file name
     // Assumption: this is a GET request and filename contains no spaces
-    // parse request
-    // get headers
 
     //Expection Format: 'GET filenane.txt HTTP/1.X'
    
-    printf("connfd = %d \n", connfd);  
-    get_line(connfd, buf, BUFSIZE);
-    
     printf("About to parse instr. \n");
-    //parse out instruction
-    while( !isspace(buf[j]) && (i < sizeof(instr) - 1))
-    {
-        instr[i] = buf[i];
-        i++;
-        j++;
-    }
-    j+=2;
-    instr[i] = '\0';
-
+    int pos = 0;
+    char* instr = next_token(arena, request, &pos);
 
     //Only accept GET requests
-    if (strncmp(instr, "GET", 3) != 0) {
-        writenbytes(connfd, bad_request, strlen(bad_request));
-        close(connfd);
+    if (instr == NULL || strncmp(instr, "GET", 3) != 0) {
+        resp->header = bad_request;
         return;
     }
 
-    //parse out filename
-    i=0;
-    while (!isspace(buf[j]) && (i < sizeof(file) - 1))
-    {
-        file[i] = buf[j];
-        i++;
-        j++;
-    }
-    j++;
-    file[i] = '\0';
-
-    //parse out type
-    i=0;
-    while (!isspace(buf[j]) && (buf[j] != '\0') && (i < sizeof(type) - 1))
+    //parse out filename (without the leading '/') and type
+    if (request[pos] != '\0')
+        pos++;
+    char* file = next_token(arena, request, &pos);
+    char* type = next_token(arena, request, &pos);
+    if (file == NULL || type == NULL)
     {
-        type[i] = buf[j];
-        i++;
-        j++;
-    }
-    type[i] = '\0';
-
-    while (get_line(connfd, buf, BUFSIZE) > 0)
-    {
-        //ignore headers -> (for now)
-    }
-
-    int length;
-    for(i = 0; i < strlen(file); i++)
-    {
-        if(file[i] == '?')
-            break;
-    }
-    length = i;
-    
-    char resource[length+1];
-
-    if (length > strlen(file)) {
-      length = strlen(file);
+        resp->header = bad_request;
+        return;
     }
 
-    strncpy(resource, file, length);
-    resource[length] = 0;
+    int length = strcspn(file, "?");
+    char* resource = arena_strndup(arena, file, length);
     
     int seat_id = parse_int_arg(file, "seat=");
     int user_id = parse_int_arg(file, "user=");
     int customer_priority = parse_int_arg(file, "priority=");
+
+    // a seat map line per seat for listings, short messages otherwise
+    int bufsize = (strncmp(resource, "list_seats", length) == 0 ||
+            strncmp(resource, "my_seats", length) == 0) ? list_seats_bufsize() : BUFSIZE;
+    char* buf = (char*) arena_alloc(arena, bufsize);
+    if (resource == NULL || buf == NULL)
+    {
+        resp->header = bad_request;
+        return;
+    }
+    resp->body = buf;
+    trace_span("parse", started_at);
     
     // Check if the request is for one of our operations
     if (strncmp(resource, "list_seats", length) == 0)
     {  
-        list_seats(buf, BUFSIZE);
-        // send headers
-        writenbytes(connfd, ok_response, strlen(ok_response));
-        // send data
-        writenbytes(connfd, buf, strlen(buf));
+        // list_seats?since=N only sends what changed after version N
+        if (has_arg(file, "since="))
+            list_seats_since(buf, bufsize, parse_int_arg(file, "since="));
+        else if (has_arg(file, "bitmap=") && parse_int_arg(file, "bitmap=") != 0)
+            list_seats_bitmap(buf, bufsize);
+        else
+            list_seats(buf, bufsize);
     } 
     else if(strncmp(resource, "view_seat", length) == 0)
     {
-        view_seat(buf, BUFSIZE, seat_id, user_id, customer_priority);
-        // send headers
-        writenbytes(connfd, ok_response, strlen(ok_response));
-        // send data
-        writenbytes(connfd, buf, strlen(buf));
+        // view_seat?...&wait=1 waits for a held seat instead of failing
+        if (has_arg(file, "wait=") && parse_int_arg(file, "wait=") != 0)
+        {
+            if (wait_seat(buf, bufsize, seat_id, user_id, customer_priority, connfd))
+            {
+                resp->parked = true;
+                return;
+            }
+        }
+        else
+            view_seat(buf, bufsize, seat_id, user_id, customer_priority);
     } 
     else if(strncmp(resource, "confirm", length) == 0)
     {
-        confirm_seat(buf, BUFSIZE, seat_id, user_id, customer_priority);
-        // send headers
-        writenbytes(connfd, ok_response, strlen(ok_response));
-        // send data
-        writenbytes(connfd, buf, strlen(buf));
+        confirm_seat(buf, bufsize, seat_id, user_id, customer_priority);
     }
     else if(strncmp(resource, "cancel", length) == 0)
     {
-        cancel(buf, BUFSIZE, seat_id, user_id, customer_priority);
-        // send headers
-        writenbytes(connfd, ok_response, strlen(ok_response));
-        // send data
-        writenbytes(connfd, buf, strlen(buf));
+        cancel(buf, bufsize, seat_id, user_id, customer_priority);
     }
-    else
+    else if(strncmp(resource, "my_seats", length) == 0)
     {
-        // try to open the file
-        if ((fd = open(resource, O_RDONLY)) == -1)
+        my_seats(buf, bufsize, user_id);
+    }
+    else if(strncmp(resource, "cancel_all", length) == 0)
+    {
+        cancel_all(buf, bufsize, user_id);
+    }
+    else if(strncmp(resource, "stats", length) == 0)
+    {
+        admission_stats(buf, bufsize);
+        replication_stats(buf+strlen(buf), bufsize-strlen(buf));
+        waitlist_stats(buf+strlen(buf), bufsize-strlen(buf));
+    }
+    else if(strcmp(resource, "promote") == 0)
+    {
+        // replica takes over as primary; an admin action, so only from
+        // this host and only by its full name
+        if (!from_loopback(connfd))
         {
-            writenbytes(connfd, notok_response, strlen(notok_response));
-        } 
+            resp->header = forbidden;
+            return;
+        }
+        replication_promote();
+        replication_stats(buf, bufsize);
+    }
+    else if(strcmp(resource, "trace") == 0)
+    {
+        // Chrome/Perfetto trace of the sampled requests still buffered;
+        // dumping is heavy and shows every request, so the same rules
+        // as promote
+        if (!from_loopback(connfd))
+        {
+            resp->header = forbidden;
+            return;
+        }
+        if ((resp->file_fd = trace_dump_fd()) == -1)
+            resp->header = notok_response;
         else
+            resp->header = json_response;
+        return;
+    }
+    else if(strncmp(resource, "seat_events", length) == 0)
+    {
+        resp->subscribe = true;
+        return;
+    }
+    else
+    {
+        // files there at startup are served from memory, compressed if
+        // the client takes it
+        char* accept_encoding = find_header(arena, request, "Accept-Encoding");
+        if (assets_find(resource, accept_encoding ? assets_accepted(accept_encoding) : 0,
+                    &resp->header, &resp->body, &resp->body_len) == 0)
+            return;
+
+        // try to open the file
+        if ((resp->file_fd = open(resource, O_RDONLY)) == -1)
         {
-            // send headers
-            writenbytes(connfd, ok_response, strlen(ok_response));
-            // send file
-            int ret;
-            while ( (ret = read(fd, buf, BUFSIZE)) > 0) {
-                writenbytes(connfd, buf, ret);
-            }  
-            // close file and free space
-            close(fd);
+            resp->header = notok_response;
         } 
+        return;
     }
-    close(connfd);
+    resp->body_len = strlen(buf);
 }
 
 int get_line(int fd, char *buf, int size)
@@ -297,3 +442,16 @@ int parse_int_arg(char* filename, char* arg)
     }
     return seatnum;
 }
+
+bool has_arg(char* filename, char* arg)
+{
+    char* args = strchr(filename, '?');
+    while (args != NULL)
+    {
+        args++;
+        if (strncmp(args, arg, strlen(arg)) == 0)
+            return true;
+        args = strchr(args, '&');
+    }
+    return false;
+}
@@ -1,7 +1,45 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+#include <stdbool.h>
+
+#include "arena.h"
+
+/**
+ *  @struct http_response_t
+ *  @brief what to send back for a request, independent of how it is sent
+ *
+ *  @var header    Status line and headers, always sent first.
+ *  @var body      Response body (body_len bytes), may be empty.
+ *  @var file_fd   File to stream after the body, -1 if none.
+ *  @var subscribe The connection is handed to the seat event publisher.
+ *  @var parked    The connection waits on a seat's waitlist, which will
+ *                 answer it; send nothing and leave it open.
+ */
+typedef struct http_response_struct
+{
+    char* header;
+    char* body;
+    int body_len;
+    int file_fd;
+    bool subscribe;
+    bool parked;
+} http_response_t;
+
 void handle_connection(int*);
 void handle_connection_wrapper(void*);
 
+/**
+ * @function handle_request
+ * @brief Parses a request and performs the operation it names, without
+ *        doing any socket I/O.
+ * @param request  The request line, optionally followed by its headers
+ *                 one per line.
+ * @param connfd   The client's socket, only kept if resp->parked is set.
+ * @param arena    Holds the parsed request and the response body until
+ *                 the response has been sent.
+ * @param resp     Filled in with the response to send.
+ */
+void handle_request(char* request, int connfd, arena_t* arena, http_response_t* resp);
+
 #endif
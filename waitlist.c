@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "waitlist.h"
+
+#define REAP_INTERVAL_MS 1000
+
+/**
+ *  @struct waiter_t
+ *  @brief a parked connection; queues are ordered by priority, highest
+ *         first, and by arrival within a priority
+ */
+typedef struct waiter_struct
+{
+    int fd;
+    int customer_id;
+    int priority;
+    uint64_t deadline;          // CLOCK_MONOTONIC ms after which it is answered anyway
+    struct waiter_struct* next;
+} waiter_t;
+
+/* Queues, the pool and the reaper's state, all behind waitlist_lock */
+static pthread_mutex_t waitlist_lock = PTHREAD_MUTEX_INITIALIZER;
+static waiter_t** queues = NULL;    // seat id -> first waiter
+static int queue_total = 0;
+
+/* Waiters come from a fixed pool so parking never allocates */
+static waiter_t* waiter_pool = NULL;
+static waiter_t* free_waiters = NULL;
+
+static uint64_t park_timeout_ms = 0;
+static pthread_t reaper;
+static pthread_cond_t reaper_wake = PTHREAD_COND_INITIALIZER;
+static int reaper_running = 0;
+
+static unsigned long parked_count = 0;
+static unsigned long handoff_count = 0;
+static unsigned long timeout_count = 0;
+
+static void* reap_waiters(void*);
+
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void waitlist_init(int number_of_seats, int max_waiters, int timeout_s)
+{
+    int i;
+
+    queues = (waiter_t**) calloc(number_of_seats, sizeof(waiter_t*));
+    queue_total = number_of_seats;
+    park_timeout_ms = (uint64_t) (timeout_s > 0 ? timeout_s : 1) * 1000;
+
+    waiter_pool = (waiter_t*) calloc(max_waiters, sizeof(waiter_t));
+    free_waiters = NULL;
+    for (i = 0; i < max_waiters; i++)
+    {
+        waiter_pool[i].next = free_waiters;
+        free_waiters = &waiter_pool[i];
+    }
+
+    if (pthread_create(&reaper, NULL, reap_waiters, NULL) == 0)
+        reaper_running = 1;
+    else
+        fprintf(stderr, "Could not start the waitlist reaper\n");
+}
+
+void waitlist_destroy()
+{
+    int i;
+
+    pthread_mutex_lock(&waitlist_lock);
+    if (reaper_running)
+    {
+        reaper_running = 0;
+        pthread_cond_signal(&reaper_wake);
+        pthread_mutex_unlock(&waitlist_lock);
+        pthread_join(reaper, NULL);
+        pthread_mutex_lock(&waitlist_lock);
+    }
+    for (i = 0; i < queue_total; i++)
+    {
+        waiter_t* curr;
+        for (curr = queues[i]; curr != NULL; curr = curr->next)
+            close(curr->fd);
+    }
+    free(queues);
+    free(waiter_pool);
+    queues = NULL;
+    queue_total = 0;
+    waiter_pool = NULL;
+    free_waiters = NULL;
+    pthread_mutex_unlock(&waitlist_lock);
+}
+
+/* Called with waitlist_lock held */
+static void release_waiter(waiter_t* waiter)
+{
+    waiter->next = free_waiters;
+    free_waiters = waiter;
+    __atomic_sub_fetch(&parked_count, 1, __ATOMIC_RELAXED);
+}
+
+int waitlist_park(int seat_id, int customer_id, int priority, int fd)
+{
+    waiter_t* waiter;
+    waiter_t** link;
+
+    pthread_mutex_lock(&waitlist_lock);
+    if (seat_id < 0 || seat_id >= queue_total || free_waiters == NULL)
+    {
+        pthread_mutex_unlock(&waitlist_lock);
+        return -1;
+    }
+    waiter = free_waiters;
+    free_waiters = waiter->next;
+
+    waiter->fd = fd;
+    waiter->customer_id = customer_id;
+    waiter->priority = priority;
+    waiter->deadline = now_ms() + park_timeout_ms;
+
+    link = &queues[seat_id];
+    while (*link != NULL && (*link)->priority >= priority)
+        link = &(*link)->next;
+    waiter->next = *link;
+    *link = waiter;
+
+    __atomic_add_fetch(&parked_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&waitlist_lock);
+    return 0;
+}
+
+/* A parked client that hung up has its end of the socket at EOF */
+static int gave_up(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+int waitlist_pop(int seat_id, int* customer_id)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&waitlist_lock);
+    if (seat_id < 0 || seat_id >= queue_total)
+    {
+        pthread_mutex_unlock(&waitlist_lock);
+        return -1;
+    }
+
+    while (fd == -1 && queues[seat_id] != NULL)
+    {
+        waiter_t* waiter = queues[seat_id];
+        queues[seat_id] = waiter->next;
+
+        if (gave_up(waiter->fd))
+        {
+            close(waiter->fd);
+        }
+        else
+        {
+            fd = waiter->fd;
+            *customer_id = waiter->customer_id;
+        }
+        release_waiter(waiter);
+    }
+    pthread_mutex_unlock(&waitlist_lock);
+    return fd;
+}
+
+/* Never blocks, the reaper and drain call it with waitlist_lock held */
+static void answer(int fd, const char* body)
+{
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+            "HTTP/1.0 200 OK\r\nContent-type: text/html\r\n\r\n%s", body);
+
+    // nothing else was ever written to the socket, so this fits
+    send(fd, response, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
+
+void waitlist_notify(int fd, const char* body, bool handed_off)
+{
+    answer(fd, body);
+    if (handed_off)
+        __atomic_add_fetch(&handoff_count, 1, __ATOMIC_RELAXED);
+}
+
+void waitlist_drain(int seat_id, const char* body)
+{
+    pthread_mutex_lock(&waitlist_lock);
+    if (seat_id >= 0 && seat_id < queue_total)
+    {
+        while (queues[seat_id] != NULL)
+        {
+            waiter_t* waiter = queues[seat_id];
+            queues[seat_id] = waiter->next;
+            answer(waiter->fd, body);
+            release_waiter(waiter);
+        }
+    }
+    pthread_mutex_unlock(&waitlist_lock);
+}
+
+/*
+ * Once a second, answer waiters whose deadline passed and drop those
+ * whose client hung up, so neither holds a pool slot forever (a seat
+ * can stay PENDING for as long as its holder likes).
+ */
+static void* reap_waiters(void* arg)
+{
+    pthread_mutex_lock(&waitlist_lock);
+    while (reaper_running)
+    {
+        struct timespec deadline;
+        uint64_t now;
+        int i;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += REAP_INTERVAL_MS / 1000;
+        pthread_cond_timedwait(&reaper_wake, &waitlist_lock, &deadline);
+        if (!reaper_running)
+            break;
+        if (__atomic_load_n(&parked_count, __ATOMIC_RELAXED) == 0)
+            continue;
+
+        now = now_ms();
+        for (i = 0; i < queue_total; i++)
+        {
+            waiter_t** link = &queues[i];
+            while (*link != NULL)
+            {
+                waiter_t* waiter = *link;
+                if (waiter->deadline <= now)
+                {
+                    answer(waiter->fd, "Seat unavailable\n\n");
+                    __atomic_add_fetch(&timeout_count, 1, __ATOMIC_RELAXED);
+                }
+                else if (gave_up(waiter->fd))
+                {
+                    close(waiter->fd);
+                }
+                else
+                {
+                    link = &waiter->next;
+                    continue;
+                }
+                *link = waiter->next;
+                release_waiter(waiter);
+            }
+        }
+    }
+    pthread_mutex_unlock(&waitlist_lock);
+    return NULL;
+}
+
+void waitlist_stats(char* buf, int bufsize)
+{
+    snprintf(buf, bufsize, "parked %lu\nhanded_off %lu\nwait_timeouts %lu\n",
+            __atomic_load_n(&parked_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&handoff_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&timeout_count, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,63 @@
+#ifndef _WAITLIST_H_
+#define _WAITLIST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per-seat queues of parked connections waiting for a held seat to be
+ * released. The queues have a lock of their own; callers still park and
+ * pop with the seat locked so the seat's state cannot change in between.
+ * A waiter nobody hands the seat to is answered "Seat unavailable" when
+ * its park timeout runs out.
+ */
+
+/**
+ * @function waitlist_init
+ * @param number_of_seats Seats ids go from 0 to number_of_seats-1.
+ * @param max_waiters     Connections that can be parked at once.
+ * @param timeout_s       Longest a connection stays parked.
+ */
+void waitlist_init(int number_of_seats, int max_waiters, int timeout_s);
+void waitlist_destroy();
+
+/**
+ * @function waitlist_park
+ * @brief Queues fd behind everyone waiting on seat_id with a priority
+ *        at least as high. The waitlist owns fd from then on.
+ * @return 0, or -1 if no more connections can be parked
+ */
+int waitlist_park(int seat_id, int customer_id, int priority, int fd);
+
+/**
+ * @function waitlist_pop
+ * @brief Takes the next waiter for seat_id off its queue, closing the
+ *        connections of waiters that gave up in the meantime.
+ * @return the waiter's fd (the caller must answer it with
+ *         waitlist_notify), or -1 if nobody is waiting
+ */
+int waitlist_pop(int seat_id, int* customer_id);
+
+/**
+ * @function waitlist_notify
+ * @brief Answers a popped waiter with body and closes its connection.
+ *        Never blocks, so it is safe with the seat still locked.
+ * @param handed_off The waiter got the seat (counted in the stats).
+ */
+void waitlist_notify(int fd, const char* body, bool handed_off);
+
+/**
+ * @function waitlist_drain
+ * @brief Answers everyone waiting on seat_id with body, e.g. once the
+ *        seat is confirmed and will never be released.
+ */
+void waitlist_drain(int seat_id, const char* body);
+
+/**
+ * @function waitlist_stats
+ * @brief Writes how many connections are parked, how many were handed
+ *        a seat and how many gave up waiting.
+ */
+void waitlist_stats(char* buf, int bufsize);
+
+#endif